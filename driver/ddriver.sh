@@ -7,6 +7,7 @@ KERNEL_DEV_PATH="/dev/ddriver"
 USER_DDRIVER="./user_ddriver"
 USER_LOG_PATH="$HOME/ddriver_log"
 USER_DEV_PATH="$HOME/ddriver"
+USER_GEO_PATH="$HOME/ddriver_geo"
 
 
 if [ -L "$0" ]; then
@@ -21,6 +22,16 @@ cd "$WORK_DIR" || exit
 CONFIG_BLOCK_SZ=512
 BLOCK_COUNT=8192
 
+# 用户态ddriver的几何参数在创建时记入$USER_GEO_PATH, 按其导出与擦除
+if [ "$DDRIVER_TYPE" != "k" ] && [ -f "$USER_GEO_PATH" ]; then
+    GEO_DISK_SZ=$(sed -n 's/^disk_size=//p' "$USER_GEO_PATH")
+    GEO_IO_SZ=$(sed -n 's/^io_size=//p' "$USER_GEO_PATH")
+    if [ -n "$GEO_DISK_SZ" ] && [ -n "$GEO_IO_SZ" ]; then
+        CONFIG_BLOCK_SZ=$GEO_IO_SZ
+        BLOCK_COUNT=$((GEO_DISK_SZ / GEO_IO_SZ))
+    fi
+fi
+
 
 function usage(){
     echo '''
@@ -41,6 +52,11 @@ function usage(){
     echo "-l            显示ddriver的Log"
     echo "-v            显示ddriver的类型[内核模块 / 用户静态链接库]"
     echo "-h            打印本帮助菜单"
+    echo "用户态ddriver首次创建时读取以下环境变量作为几何参数, 之后沿用$USER_GEO_PATH: "
+    echo "DDRIVER_DISK_SZ DDRIVER_IO_SZ DDRIVER_TRACK_NUM DDRIVER_READ_LAT DDRIVER_WRITE_LAT DDRIVER_SEEK_LAT DDRIVER_WCACHE(设备写缓存, 默认0即写直达) DDRIVER_NCQ(设备命令队列深度, 最大32, 默认0即不排队)"
+    echo "同级镜像${USER_DEV_PATH}1等各为独立设备, 几何参数存于各自的<镜像>_geo, 可由newfs --device=镜像1,镜像2 --stripe_kb=N 组成条带卷, 加--raid=1组成镜像卷, --raid=5/6组成单/双校验卷"
+    echo "另以DDRIVER_PROFILE=nvme DDRIVER_DISK_SZ=1M创建小镜像如${USER_DEV_PATH}fast, 由newfs --fast=该镜像 作快层: 元数据固定其上, 热数据块自动迁入"
+    echo "每次打开时读取: DDRIVER_PROFILE=[hdd|ssd|nvme|zero] 切换延迟模型, DDRIVER_CLOCK=virtual 只累计模拟时间不睡眠"
     echo "===================================================================="
 }
 
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
@@ -5,11 +6,18 @@
 #include <fcntl.h>
 #include "string.h"
 #include <linux/fs.h>
+#include <linux/falloc.h>
 #include "ddriver_ctl.h"
 #include "stdio.h"
 #include "errno.h"
 #include <pwd.h>
 #include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <limits.h>
+#include <pthread.h>
 
 extern int errno;
 
@@ -44,121 +52,1161 @@ extern int errno;
 #define DRIVER_DESC     "A Fake disk driver in user space"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)                   /* 未指定几何时的缺省值 */
 #define CONFIG_BLOCK_SZ (512)
+#define DEVICE_GEO    "ddriver_geo"                         /* 几何参数旁路文件，创建设备时写入 */
+#define DDRIVER_MAX_HANDLES 64                              /* 同时打开的句柄上限 */
+#define DDRIVER_MAX_DEVICES 8                               /* 同一进程可打开的设备镜像数上限 */
+#define DDRIVER_NCQ_AGING   8                               /* 命令被后到命令超越的次数上限，防止饿死 */
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define DEV_DISK_SZ             (dev->layout_size)
+#define DEV_BLOCK_SZ            (dev->iounit_size)
+#define IS_ADDR_ALIGN(addr)     (addr % DEV_BLOCK_SZ == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / DEV_BLOCK_SZ) * DEV_BLOCK_SZ)
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+#define STAT_ADD(field, val)    (__atomic_fetch_add(&dev->stats.field, (val), __ATOMIC_RELAXED))
 
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
+/* 设备命令队列中的一条命令 */
+struct ddriver_ncq_cmd
+{
+    off_t offset;
+    long  seq;                                       /* 到达顺序 */
+    int   skipped;                                   /* 被后到命令超越的次数 */
+    int   chosen;                                    /* 已被设备选中执行 */
+};
+
+/* 设备命令队列(NCQ)，同步请求在此等待，设备空闲时挑选定位时间最短的命令执行 */
+struct ddriver_ncq
+{
+    int  busy;                                       /* 设备正在执行命令 */
+    int  nr_queued;
+    long seq;
+    struct ddriver_ncq_cmd *queue[DDRIVER_NCQ_MAX_DEPTH];
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+};
+
+/* 设备内部的易失写缓存，以IO单元为粒度缓存脏块，满或FLUSH时按设备选择的顺序落盘 */
+struct ddriver_wcache
+{
+    int    nr_slots;                                 /* 槽位数，0表示未开启 */
+    int    nr_used;                                  /* 已占用的槽位[0, nr_used)，作废时由末槽补位 */
+    int    nr_dirty;                                 /* 仍有效的脏块 */
+    off_t *blk;                                      /* 槽位缓存的块号，-1表示空闲 */
+    int   *hash;                                     /* 按块号散列的桶头，桶数 = nr_slots */
+    int   *next;                                     /* 桶内链 */
+    int   *order;                                    /* 落盘时排序用 */
+    char  *data;
+    pthread_mutex_t lock;
+};
+
+/* 一个设备镜像，各镜像的几何、磁头、缓存与统计相互独立 */
 struct ddriver
 {
     int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
-    int  read_lat;
-    int  write_lat;
-    int  seek_lat;
+    struct ddriver_stats stats;                      /* 64位计数，IOC_REQ_DEVICE_STATE由此截取 */
+    int  read_lat;                                   /* us */
+    int  write_lat;                                  /* us */
+    int  seek_lat;                                   /* us, 旋转一圈 */
+    int  xfer_mbps;                                  /* 传输带宽MB/s，0表示不计传输时间 */
+    int  profile;                                    /* DDRIVER_PROFILE_* */
+    int  clock;                                      /* DDRIVER_CLOCK_REAL / DDRIVER_CLOCK_VIRTUAL */
+    int64_t vtime_seek_ns;                           /* 累计的模拟寻道与旋转时间 */
+    int64_t vtime_rw_ns;                             /* 累计的模拟访问与传输时间 */
     int  track_num;
     int  major_num;
-    int  layout_size;
+    off_t layout_size;
     int  iounit_size;
+    off_t head;                                      /* 模拟磁头位置，该设备的所有句柄共享 */
+    long busy_until_us;                              /* 异步请求排到的模拟设备忙碌时刻 */
+    int  nr_open;                                    /* 该设备已打开的句柄数 */
+    int  backend;                                    /* DDRIVER_BACKEND_FILE / DDRIVER_BACKEND_MMAP */
+    char *map;                                       /* MMAP后端下整个设备文件的共享映射 */
+    off_t wcache_size;                               /* 设备写缓存容量(字节)，0表示写直达 */
+    int  ncq_depth;                                  /* 设备命令队列深度，0表示不排队 */
+    char path[128];                                  /* 设备镜像路径，同一路径的句柄共享本结构 */
+    struct ddriver_wcache wcache;
+    struct ddriver_ncq ncq;
+};
+
+/* io_uring环，句柄首次ddriver_submit时建立；内核不支持时退化为同步pread/pwrite */
+struct ddriver_uring
+{
+    int       state;                                 /* 0: 未建立, 1: io_uring, 2: 同步退化 */
+    int       ring_fd;
+    unsigned  entries;
+    unsigned  inflight;                              /* 已提交给内核尚未收割 */
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void     *sq_ptr;
+    size_t    sq_sz;
+    void     *cq_ptr;
+    size_t    cq_sz;
+    size_t    sqes_sz;
+    int       nr_pending;                            /* 内核已完成、模拟时刻未到 */
+    struct ddriver_req *pending[DDRIVER_QUEUE_DEPTH];
+};
+
+/* 每次ddriver_open得到一个句柄，句柄之间互不干扰，同一句柄的顺序接口与异步队列不可跨线程共享 */
+struct ddriver_handle
+{
+    int  used;
+    int  fd;
+    struct ddriver *dev;
+    off_t pos;                                       /* ddriver_seek/read/write的当前位置 */
+    struct ddriver_uring uring;
 };
 /******************************************************************************
 * SECTION: Global Variable
 *******************************************************************************/
 /* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
-struct ddriver disk = {
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
+/* 新设备的缺省参数 */
+const struct ddriver ddriver_defaults = {
+    .read_lat    = 2000,    /* 2ms */       
+    .write_lat   = 1000,    /* 1ms */
+    .seek_lat    = 4000,    /* 4.17ms per 360 degree */
+    .xfer_mbps   = 150,
+    .profile     = DDRIVER_PROFILE_HDD,
+    .clock       = DDRIVER_CLOCK_REAL,
     .major_num   = 0,
     .track_num   = 100,
     .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .head        = 0,
+    .busy_until_us = 0,
+    .nr_open     = 0,
+    .backend     = DDRIVER_BACKEND_FILE,
+    .map         = NULL,
+    .wcache_size = 0,
+    .ncq_depth   = 0
 };
 
+/* 按路径打开过的设备，进程内一直保留，重新打开时沿用统计 */
+struct ddriver devices[DDRIVER_MAX_DEVICES];
+int nr_devices = 0;
+
 FILE *debugf = NULL;
+
+/* 打开、关闭与切换后端互斥；读写路径只做原子操作，不加锁 */
+pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+struct ddriver_handle handles[DDRIVER_MAX_HANDLES];
+int nr_handles = 0;
+
+struct ddriver_profile
+{
+    const char *name;
+    int read_lat;
+    int write_lat;
+    int seek_lat;
+    int xfer_mbps;
+};
+
+/* 延迟单位us，SSD/NVMe无机械寻道 */
+const struct ddriver_profile profiles[] = {
+    [DDRIVER_PROFILE_HDD]  = { "hdd",  2000, 1000, 4000, 150  },
+    [DDRIVER_PROFILE_SSD]  = { "ssd",  80,   30,   0,    500  },
+    [DDRIVER_PROFILE_NVME] = { "nvme", 20,   10,   0,    3000 },
+    [DDRIVER_PROFILE_ZERO] = { "zero", 0,    0,    0,    0    },
+};
+
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
-int check_valid(size_t size) {
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+int check_valid(struct ddriver *dev, size_t size) {
+    if (size != DEV_BLOCK_SZ){
+        user_alert("io size %ld should align to %d", size, DEV_BLOCK_SZ);
+        return -EIO;
+    }
+    return 0;
+}
+
+int check_valid_blocks(struct ddriver *dev, int blk_cnt) {
+    if (blk_cnt <= 0 || (size_t)blk_cnt * DEV_BLOCK_SZ > DEV_DISK_SZ){
+        user_alert("block count %d out of range", blk_cnt);
         return -EIO;
     }
     return 0;
 }
 
-int emulate_rotate(int fd, off_t start, off_t end) {
-    int bytes_per_track = disk.layout_size / disk.track_num;
-    int lat_per_track = disk.seek_lat;
-    int distance = abs(end - start) % bytes_per_track; 
-    
-    if (distance == 0) {
+int64_t rotate_lat_ns(struct ddriver *dev, off_t start, off_t end) {
+    off_t bytes_per_track = dev->layout_size / dev->track_num;
+    int lat_per_track = dev->seek_lat;
+    off_t distance = labs(end - start) % bytes_per_track; 
+
+    return (int64_t)distance * lat_per_track * 1000 / bytes_per_track;
+}
+
+int64_t xfer_ns(struct ddriver *dev, size_t size) {
+    return dev->xfer_mbps > 0 ? (int64_t)size * 1000 / dev->xfer_mbps : 0;
+}
+
+int64_t access_lat_ns(struct ddriver *dev, int op, size_t size) {
+    return (op == DDRIVER_OP_READ ? dev->read_lat : dev->write_lat) * 1000LL + xfer_ns(dev, size);
+}
+
+void account_vtime(struct ddriver *dev, int64_t seek_ns, int64_t rw_ns) {
+    __atomic_fetch_add(&dev->vtime_seek_ns, seek_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dev->vtime_rw_ns, rw_ns, __ATOMIC_RELAXED);
+}
+void account_seek(struct ddriver *dev, off_t from, off_t to) {
+    STAT_ADD(seek_cnt, 1);
+    STAT_ADD(seek_distance, labs(to - from));
+}
+/**
+ * @brief 记录一次读写请求的次数、字节数与模拟延迟分布
+ * 
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param size 
+ * @param lat_ns 该请求的模拟延迟
+ */
+void account_io(struct ddriver *dev, int op, size_t size, int64_t lat_ns) {
+    uint64_t lat_us = lat_ns / 1000;
+    int bucket = lat_us == 0 ? 0 : 64 - __builtin_clzll(lat_us);
+
+    if (bucket >= DDRIVER_LAT_BUCKETS) {
+        bucket = DDRIVER_LAT_BUCKETS - 1;
+    }
+    if (op == DDRIVER_OP_READ) {
+        STAT_ADD(read_cnt, 1);
+        STAT_ADD(read_bytes, size);
+        STAT_ADD(read_lat_hist[bucket], 1);
+    }
+    else {
+        STAT_ADD(write_cnt, 1);
+        STAT_ADD(write_bytes, size);
+        STAT_ADD(write_lat_hist[bucket], 1);
+    }
+}
+/**
+ * @brief 真实时钟下睡眠，不计入模拟时间
+ * 
+ * @param ns 
+ */
+void device_sleep(struct ddriver *dev, int64_t ns) {
+    if (dev->clock == DDRIVER_CLOCK_REAL && ns >= 1000) {
+        usleep(ns / 1000);
+    }
+}
+/**
+ * @brief 计入模拟设备时间，真实时钟下同时睡眠相应时长
+ * 
+ * @param seek_ns 寻道与旋转
+ * @param rw_ns 访问与传输
+ */
+void emulate_delay(struct ddriver *dev, int64_t seek_ns, int64_t rw_ns) {
+    account_vtime(dev, seek_ns, rw_ns);
+    device_sleep(dev, seek_ns + rw_ns);
+}
+/**
+ * @brief 一次读写请求的延迟模拟与统计
+ * 
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param size 
+ * @param seek_ns 请求前的寻道与旋转时间
+ */
+void emulate_io(struct ddriver *dev, int op, size_t size, int64_t seek_ns) {
+    int64_t rw_ns = access_lat_ns(dev, op, size);
+
+    emulate_delay(dev, seek_ns, rw_ns);
+    account_io(dev, op, size, seek_ns + rw_ns);
+}
+
+long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+int check_valid_range(struct ddriver *dev, off_t offset, size_t size) {
+    if (!IS_ADDR_ALIGN(offset) || size == 0 || size % DEV_BLOCK_SZ != 0 
+        || offset < 0 || offset + size > DEV_DISK_SZ) {
+        user_alert("io [%ld, +%ld) should align to %d and lie in device", 
+                   offset, size, DEV_BLOCK_SZ);
+        return -EIO;
+    }
+    return 0;
+}
+/**
+ * @brief 映射只覆盖[0, DEV_DISK_SZ)，越界的拷贝会踩到映射之外的内存
+ */
+int map_range_ok(struct ddriver *dev, off_t offset, size_t size) {
+    if (offset < 0 || offset + size > DEV_DISK_SZ) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+/**
+ * @brief 按当前后端在设备偏移处读写，MMAP后端直接拷贝映射内存
+ */
+ssize_t dev_pread(struct ddriver *dev, int fd, char *buf, size_t size, off_t offset) {
+    if (dev->backend == DDRIVER_BACKEND_MMAP) {
+        if (!map_range_ok(dev, offset, size))
+            return -1;
+        memcpy(buf, dev->map + offset, size);
+        return size;
+    }
+    return pread(fd, buf, size, offset);
+}
+
+ssize_t dev_pwrite(struct ddriver *dev, int fd, const char *buf, size_t size, off_t offset) {
+    if (dev->backend == DDRIVER_BACKEND_MMAP) {
+        if (!map_range_ok(dev, offset, size))
+            return -1;
+        memcpy(dev->map + offset, buf, size);
+        return size;
+    }
+    return pwrite(fd, buf, size, offset);
+}
+
+/**
+ * @brief 在后备文件上打洞，被丢弃的区间读出全零且不再占用宿主磁盘；
+ * 宿主文件系统不支持打洞时退化为写零
+ * 
+ * @param fd 
+ * @param offset 
+ * @param len 
+ * @return int 
+ */
+int punch_hole(struct ddriver *dev, int fd, off_t offset, off_t len) {
+    char buf[4096] = {'\0'};
+    off_t i;
+
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0) {
+        return 0;
+    }
+    for (i = 0; i < len; i += 4096) {
+        if (dev_pwrite(dev, fd, buf, len - i < 4096 ? len - i : 4096, offset + i) < 0)
+            return -errno;
+    }
+    return 0;
+}
+
+int set_backend(struct ddriver *dev, int fd, int backend) {
+    char *map;
+
+    if (backend == dev->backend) {
+        return 0;
+    }
+    if (backend == DDRIVER_BACKEND_MMAP) {
+        map = mmap(NULL, DEV_DISK_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            user_alert("mmap device failed: %s", strerror(errno));
+            return -ENOMEM;
+        }
+        dev->map = map;
+    }
+    else if (backend == DDRIVER_BACKEND_FILE) {
+        msync(dev->map, DEV_DISK_SZ, MS_SYNC);
+        munmap(dev->map, DEV_DISK_SZ);
+        dev->map = NULL;
+    }
+    else {
+        return -EINVAL;
+    }
+    dev->backend = backend;
+    return 0;
+}
+/**
+ * @brief 解析带K/M/G后缀的大小
+ */
+off_t parse_size(const char *str) {
+    char *end;
+    off_t val = strtoll(str, &end, 0);
+
+    switch (*end)
+    {
+    case 'g': case 'G': val <<= 10; /* fall through */
+    case 'm': case 'M': val <<= 10; /* fall through */
+    case 'k': case 'K': val <<= 10; break;
+    default: break;
+    }
+    return val;
+}
+
+int set_profile(struct ddriver *dev, const char *name) {
+    int i;
+
+    for (i = 0; i < (int)(sizeof(profiles) / sizeof(profiles[0])); i++) {
+        if (strcmp(name, profiles[i].name) == 0) {
+            dev->read_lat = profiles[i].read_lat;
+            dev->write_lat = profiles[i].write_lat;
+            dev->seek_lat = profiles[i].seek_lat;
+            dev->xfer_mbps = profiles[i].xfer_mbps;
+            dev->profile = i;
+            return 0;
+        }
+    }
+    user_panic("unknown latency profile [%s], keep current", name);
+    return -EINVAL;
+}
+
+void geo_from_env(struct ddriver *dev) {
+    char *env;
+
+    if ((env = getenv("DDRIVER_DISK_SZ")) != NULL)
+        dev->layout_size = parse_size(env);
+    if ((env = getenv("DDRIVER_IO_SZ")) != NULL)
+        dev->iounit_size = parse_size(env);
+    if ((env = getenv("DDRIVER_TRACK_NUM")) != NULL)
+        dev->track_num = atoi(env);
+    if ((env = getenv("DDRIVER_WCACHE")) != NULL)
+        dev->wcache_size = parse_size(env);
+    if ((env = getenv("DDRIVER_NCQ")) != NULL)
+        dev->ncq_depth = atoi(env);
+    if ((env = getenv("DDRIVER_PROFILE")) != NULL)
+        set_profile(dev, env);
+    /* 单独指定的延迟(ms)覆盖profile */
+    if ((env = getenv("DDRIVER_READ_LAT")) != NULL) {
+        dev->read_lat = atoi(env) * 1000;
+        dev->profile = DDRIVER_PROFILE_CUSTOM;
+    }
+    if ((env = getenv("DDRIVER_WRITE_LAT")) != NULL) {
+        dev->write_lat = atoi(env) * 1000;
+        dev->profile = DDRIVER_PROFILE_CUSTOM;
+    }
+    if ((env = getenv("DDRIVER_SEEK_LAT")) != NULL) {
+        dev->seek_lat = atoi(env) * 1000;
+        dev->profile = DDRIVER_PROFILE_CUSTOM;
+    }
+}
+
+int geo_load(struct ddriver *dev, const char *path) {
+    FILE *fp = fopen(path, "r");
+    char key[32];
+    long long val;
+
+    if (fp == NULL)
+        return -ENOENT;
+    while (fscanf(fp, " %31[^=]=%lld", key, &val) == 2) {
+        if (strcmp(key, "disk_size") == 0)
+            dev->layout_size = val;
+        else if (strcmp(key, "io_size") == 0)
+            dev->iounit_size = val;
+        else if (strcmp(key, "track_num") == 0)
+            dev->track_num = val;
+        else if (strcmp(key, "read_lat_us") == 0)
+            dev->read_lat = val;
+        else if (strcmp(key, "write_lat_us") == 0)
+            dev->write_lat = val;
+        else if (strcmp(key, "seek_lat_us") == 0)
+            dev->seek_lat = val;
+        else if (strcmp(key, "xfer_mbps") == 0)
+            dev->xfer_mbps = val;
+        else if (strcmp(key, "profile") == 0)
+            dev->profile = val;
+        else if (strcmp(key, "wcache_size") == 0)
+            dev->wcache_size = val;
+        else if (strcmp(key, "ncq_depth") == 0)
+            dev->ncq_depth = val;
+        else if (strcmp(key, "read_lat") == 0)           /* 旧旁路文件以ms为单位 */
+            dev->read_lat = val * 1000;
+        else if (strcmp(key, "write_lat") == 0)
+            dev->write_lat = val * 1000;
+        else if (strcmp(key, "seek_lat") == 0)
+            dev->seek_lat = val * 1000;
+    }
+    fclose(fp);
+    return 0;
+}
+
+int geo_store(struct ddriver *dev, const char *path) {
+    FILE *fp = fopen(path, "w");
+
+    if (fp == NULL)
+        return -errno;
+    fprintf(fp, "disk_size=%lld\nio_size=%d\ntrack_num=%d\n"
+                "read_lat_us=%d\nwrite_lat_us=%d\nseek_lat_us=%d\nxfer_mbps=%d\nprofile=%d\n"
+                "wcache_size=%lld\nncq_depth=%d\n",
+            (long long)dev->layout_size, dev->iounit_size, dev->track_num,
+            dev->read_lat, dev->write_lat, dev->seek_lat, dev->xfer_mbps, dev->profile,
+            (long long)dev->wcache_size, dev->ncq_depth);
+    fclose(fp);
+    return 0;
+}
+
+int geo_check(struct ddriver *dev) {
+    if (dev->iounit_size < CONFIG_BLOCK_SZ || (dev->iounit_size & (dev->iounit_size - 1)) != 0
+        || dev->layout_size < dev->iounit_size || dev->layout_size % dev->iounit_size != 0
+        || dev->track_num <= 0 || dev->layout_size / dev->track_num == 0
+        || dev->wcache_size < 0 || dev->wcache_size > dev->layout_size
+        || dev->ncq_depth < 0 || dev->ncq_depth > DDRIVER_NCQ_MAX_DEPTH) {
+        user_panic("bad geometry: disk %lld, io unit %d, tracks %d, write cache %lld, ncq %d", 
+                   (long long)dev->layout_size, dev->iounit_size, dev->track_num,
+                   (long long)dev->wcache_size, dev->ncq_depth);
+        return -EINVAL;
+    }
+    return 0;
+}
+/**
+ * @brief 将磁头移动到offset并在移动时计一次SEEK，IO结束后磁头停在offset + size
+ * 
+ * @param dev 
+ * @param offset 
+ * @param size 
+ * @return int64_t 本次移动的寻道与旋转时间(ns)
+ */
+int64_t move_head(struct ddriver *dev, off_t offset, size_t size) {
+    off_t cur = __atomic_exchange_n(&dev->head, offset + size, __ATOMIC_RELAXED);
+    if (cur != offset) {
+        account_seek(dev, cur, offset);
+        return rotate_lat_ns(dev, cur, offset);
+    }
+    return 0;
+}
+/**
+ * @brief 按文件描述符查找句柄，不加锁
+ * 
+ * @param fd 
+ * @return struct ddriver_handle* 未打开的描述符返回NULL
+ */
+struct ddriver_handle *handle_get(int fd) {
+    int i;
+
+    for (i = 0; i < DDRIVER_MAX_HANDLES; i++) {
+        if (__atomic_load_n(&handles[i].used, __ATOMIC_ACQUIRE) && 
+            __atomic_load_n(&handles[i].fd, __ATOMIC_RELAXED) == fd)
+            return &handles[i];
+    }
+    user_panic("fd %d is not an open ddriver handle", fd);
+    return NULL;
+}
+/**
+ * @brief 逐个原子地读取统计计数，与并发的读写互不阻塞
+ * 
+ * @param stats 
+ */
+void stats_snapshot(struct ddriver *dev, struct ddriver_stats *stats) {
+    uint64_t *src = (uint64_t *)&dev->stats;
+    uint64_t *dst = (uint64_t *)stats;
+    size_t i;
+
+    for (i = 0; i < sizeof(struct ddriver_stats) / sizeof(uint64_t); i++)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+void stats_reset(struct ddriver *dev) {
+    uint64_t *cnt = (uint64_t *)&dev->stats;
+    size_t i;
+
+    for (i = 0; i < sizeof(struct ddriver_stats) / sizeof(uint64_t); i++)
+        __atomic_store_n(&cnt[i], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&dev->vtime_seek_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&dev->vtime_rw_ns, 0, __ATOMIC_RELAXED);
+}
+/**
+ * @brief 撤掉句柄的io_uring环
+ * 
+ * @param uring 
+ */
+void uring_teardown(struct ddriver_uring *uring) {
+    if (uring->state == 1) {
+        munmap(uring->sqes, uring->sqes_sz);
+        if (uring->cq_ptr != uring->sq_ptr) {
+            munmap(uring->cq_ptr, uring->cq_sz);
+        }
+        munmap(uring->sq_ptr, uring->sq_sz);
+        close(uring->ring_fd);
+    }
+    uring->state = 0;
+    uring->ring_fd = -1;
+    uring->inflight = 0;
+    uring->nr_pending = 0;
+}
+/**
+ * @brief 首个句柄打开时确定几何参数、延迟profile与时钟
+ * 
+ * @param geo_path 
+ * @return int 
+ */
+int device_setup(struct ddriver *dev, const char *geo_path) {
+    char *env;
+
+    /* 几何参数在创建时由环境变量决定并记入旁路文件，之后每次打开沿用 */
+    if (geo_load(dev, geo_path) != 0) {
+        geo_from_env(dev);
+        if (geo_check(dev) < 0)
+            return -EINVAL;
+        if (geo_store(dev, geo_path) < 0) {
+            user_panic("can't store geometry: %s", geo_path);
+            return -1;
+        }
+    }
+    else {
+        /* 已有设备也可在打开时换用其他延迟profile，不写回旁路文件 */
+        if ((env = getenv("DDRIVER_PROFILE")) != NULL)
+            set_profile(dev, env);
+        if (geo_check(dev) < 0)
+            return -EINVAL;
+    }
+    env = getenv("DDRIVER_CLOCK");
+    dev->clock = env != NULL && strcmp(env, "virtual") == 0 ? 
+                 DDRIVER_CLOCK_VIRTUAL : DDRIVER_CLOCK_REAL;
+    return 0;
+}
+/**
+ * @brief 按路径找到设备，首次打开该路径时分配并以缺省参数初始化，调用者持有open_lock
+ * 
+ * @param path 
+ * @return struct ddriver* 设备数已达上限时返回NULL
+ */
+struct ddriver *device_get(const char *path) {
+    struct ddriver *dev;
+    int i;
+
+    for (i = 0; i < nr_devices; i++) {
+        if (strcmp(devices[i].path, path) == 0)
+            return &devices[i];
+    }
+    if (nr_devices == DDRIVER_MAX_DEVICES)
+        return NULL;
+    dev = &devices[nr_devices++];
+    *dev = ddriver_defaults;
+    strcpy(dev->path, path);
+    pthread_mutex_init(&dev->wcache.lock, NULL);
+    pthread_mutex_init(&dev->ncq.lock, NULL);
+    pthread_cond_init(&dev->ncq.cond, NULL);
+    return dev;
+}
+/******************************************************************************
+* SECTION: Command Queue
+*******************************************************************************/
+/**
+ * @brief 从排队的命令中挑出定位时间最短的一条，等待过久的最早命令优先
+ * 
+ * @param queue 排队的命令
+ * @param n 命令数，须大于0
+ * @return int 选中命令在queue中的下标
+ */
+int ncq_choose(struct ddriver *dev, struct ddriver_ncq_cmd *queue[], int n) {
+    off_t head = __atomic_load_n(&dev->head, __ATOMIC_RELAXED);
+    int64_t lat, best_lat = INT64_MAX;
+    uint64_t max;
+    int oldest = 0, best = 0, i;
+
+    for (i = 0; i < n; i++) {
+        if (queue[i]->seq < queue[oldest]->seq)
+            oldest = i;
+        lat = rotate_lat_ns(dev, head, queue[i]->offset);
+        if (lat < best_lat) {
+            best_lat = lat;
+            best = i;
+        }
+    }
+    if (queue[oldest]->skipped >= DDRIVER_NCQ_AGING)
+        best = oldest;
+
+    if (best != oldest) {
+        STAT_ADD(ncq_reorder_cnt, 1);
+        STAT_ADD(ncq_saved_ns, rotate_lat_ns(dev, head, queue[oldest]->offset) - best_lat);
+        for (i = 0; i < n; i++) {
+            if (queue[i]->seq < queue[best]->seq)
+                queue[i]->skipped++;
+        }
+    }
+    STAT_ADD(ncq_cmd_cnt, 1);
+    STAT_ADD(ncq_depth_sum, n);
+    max = __atomic_load_n(&dev->stats.ncq_depth_max, __ATOMIC_RELAXED);
+    while (max < (uint64_t)n && !__atomic_compare_exchange_n(&dev->stats.ncq_depth_max, &max, n, 0,
+                                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return best;
+}
+/**
+ * @brief 设备空闲时派发下一条命令，调用者持有ncq.lock
+ */
+void ncq_dispatch(struct ddriver *dev) {
+    int i;
+
+    if (dev->ncq.busy || dev->ncq.nr_queued == 0)
+        return;
+    i = ncq_choose(dev, dev->ncq.queue, dev->ncq.nr_queued);
+    dev->ncq.queue[i]->chosen = 1;
+    dev->ncq.queue[i] = dev->ncq.queue[--dev->ncq.nr_queued];
+    dev->ncq.busy = 1;
+    pthread_cond_broadcast(&dev->ncq.cond);
+}
+/**
+ * @brief 命令进入设备队列，队列满时等待空位，返回时设备已选中该命令
+ * 
+ * @param cmd 
+ * @param offset 
+ */
+void ncq_enter(struct ddriver *dev, struct ddriver_ncq_cmd *cmd, off_t offset) {
+    if (dev->ncq_depth == 0)
+        return;
+    pthread_mutex_lock(&dev->ncq.lock);
+    /* 队列深度包含正在执行的命令 */
+    while (dev->ncq.nr_queued + dev->ncq.busy >= dev->ncq_depth)
+        pthread_cond_wait(&dev->ncq.cond, &dev->ncq.lock);
+    cmd->offset = offset;
+    cmd->seq = dev->ncq.seq++;
+    cmd->skipped = 0;
+    cmd->chosen = 0;
+    dev->ncq.queue[dev->ncq.nr_queued++] = cmd;
+    ncq_dispatch(dev);
+    while (!cmd->chosen)
+        pthread_cond_wait(&dev->ncq.cond, &dev->ncq.lock);
+    pthread_mutex_unlock(&dev->ncq.lock);
+}
+/**
+ * @brief 当前命令执行完毕，设备转去执行队列中的下一条
+ */
+void ncq_leave(struct ddriver *dev) {
+    if (dev->ncq_depth == 0)
+        return;
+    pthread_mutex_lock(&dev->ncq.lock);
+    dev->ncq.busy = 0;
+    ncq_dispatch(dev);
+    /* 没有排队的命令时也要唤醒等待空位者 */
+    pthread_cond_broadcast(&dev->ncq.cond);
+    pthread_mutex_unlock(&dev->ncq.lock);
+}
+/******************************************************************************
+* SECTION: Write Cache
+*******************************************************************************/
+void wcache_destroy(struct ddriver *dev) {
+    free(dev->wcache.blk);
+    free(dev->wcache.hash);
+    free(dev->wcache.next);
+    free(dev->wcache.order);
+    free(dev->wcache.data);
+    dev->wcache.blk = NULL;
+    dev->wcache.hash = NULL;
+    dev->wcache.next = NULL;
+    dev->wcache.order = NULL;
+    dev->wcache.data = NULL;
+    dev->wcache.nr_slots = 0;
+}
+
+int wcache_init(struct ddriver *dev) {
+    int n = dev->wcache_size / DEV_BLOCK_SZ;
+
+    dev->wcache.nr_slots = 0;
+    dev->wcache.nr_used = 0;
+    dev->wcache.nr_dirty = 0;
+    if (n == 0)
+        return 0;
+    dev->wcache.blk = (off_t *)malloc(n * sizeof(off_t));
+    dev->wcache.hash = (int *)malloc(n * sizeof(int));
+    dev->wcache.next = (int *)malloc(n * sizeof(int));
+    dev->wcache.order = (int *)malloc(n * sizeof(int));
+    dev->wcache.data = (char *)malloc((size_t)n * DEV_BLOCK_SZ);
+    if (!dev->wcache.blk || !dev->wcache.hash || !dev->wcache.next || !dev->wcache.order || !dev->wcache.data) {
+        wcache_destroy(dev);
+        return -ENOMEM;
+    }
+    memset(dev->wcache.hash, -1, n * sizeof(int));
+    dev->wcache.nr_slots = n;
+    return 0;
+}
+
+int wcache_find(struct ddriver *dev, off_t blk) {
+    int slot = dev->wcache.hash[blk % dev->wcache.nr_slots];
+
+    while (slot >= 0 && dev->wcache.blk[slot] != blk)
+        slot = dev->wcache.next[slot];
+    return slot;
+}
+
+/**
+ * @brief 从桶链中找到指向slot的位置
+ */
+int *wcache_link(struct ddriver *dev, int slot) {
+    int *cursor = &dev->wcache.hash[dev->wcache.blk[slot] % dev->wcache.nr_slots];
+
+    while (*cursor != slot)
+        cursor = &dev->wcache.next[*cursor];
+    return cursor;
+}
+/**
+ * @brief 作废一个槽位并把最后一个槽位移入，已占用的槽位始终是[0, nr_used)，
+ * 被作废的块不再占用缓存容量
+ */
+void wcache_unlink(struct ddriver *dev, int slot) {
+    int last = dev->wcache.nr_used - 1;
+
+    *wcache_link(dev, slot) = dev->wcache.next[slot];
+    if (slot != last) {
+        *wcache_link(dev, last) = slot;
+        dev->wcache.blk[slot] = dev->wcache.blk[last];
+        dev->wcache.next[slot] = dev->wcache.next[last];
+        memcpy(dev->wcache.data + (size_t)slot * DEV_BLOCK_SZ,
+               dev->wcache.data + (size_t)last * DEV_BLOCK_SZ, DEV_BLOCK_SZ);
+    }
+    dev->wcache.blk[last] = -1;
+    dev->wcache.nr_used--;
+    dev->wcache.nr_dirty--;
+}
+
+int wcache_cmp(const void *a, const void *b, void *arg) {
+    struct ddriver *dev = (struct ddriver *)arg;
+    off_t lhs = dev->wcache.blk[*(const int *)a];
+    off_t rhs = dev->wcache.blk[*(const int *)b];
+    return (lhs > rhs) - (lhs < rhs);
+}
+/**
+ * @brief 将所有脏块落盘并清空缓存，调用者持有wcache.lock；
+ * 从磁头位置按C-SCAN顺序写出，块号相邻的合并为一次介质写
+ * 
+ * @param fd 
+ * @param ns 累加落盘耗费的模拟设备时间，已计入vtime，由调用者决定是否睡眠
+ * @return int 
+ */
+int wcache_destage(struct ddriver *dev, int fd, int64_t *ns) {
+    off_t head_blk = __atomic_load_n(&dev->head, __ATOMIC_RELAXED) / DEV_BLOCK_SZ;
+    off_t blk;
+    int64_t seek_ns, rw_ns;
+    int n = 0, start, i, k, run;
+
+    for (i = 0; i < dev->wcache.nr_used; i++)
+        dev->wcache.order[n++] = i;
+    qsort_r(dev->wcache.order, n, sizeof(int), wcache_cmp, dev);
+    for (start = 0; start < n && dev->wcache.blk[dev->wcache.order[start]] < head_blk; start++);
+
+    for (k = 0; k < n; k += run) {
+        blk = dev->wcache.blk[dev->wcache.order[(start + k) % n]];
+        for (run = 1; k + run < n && dev->wcache.blk[dev->wcache.order[(start + k + run) % n]] == blk + run; run++);
+        for (i = 0; i < run; i++) {
+            if (dev_pwrite(dev, fd, dev->wcache.data + (size_t)dev->wcache.order[(start + k + i) % n] * DEV_BLOCK_SZ,
+                           DEV_BLOCK_SZ, (blk + i) * DEV_BLOCK_SZ) != DEV_BLOCK_SZ) {
+                user_panic("destage error: %s", strerror(errno));
+                return -EIO;
+            }
+        }
+        seek_ns = move_head(dev, blk * DEV_BLOCK_SZ, (size_t)run * DEV_BLOCK_SZ);
+        rw_ns = access_lat_ns(dev, DDRIVER_OP_WRITE, (size_t)run * DEV_BLOCK_SZ);
+        account_vtime(dev, seek_ns, rw_ns);
+        *ns += seek_ns + rw_ns;
+        STAT_ADD(destage_cnt, 1);
+        STAT_ADD(destage_bytes, (uint64_t)run * DEV_BLOCK_SZ);
+    }
+
+    memset(dev->wcache.hash, -1, dev->wcache.nr_slots * sizeof(int));
+    dev->wcache.nr_used = 0;
+    dev->wcache.nr_dirty = 0;
+    return 0;
+}
+/**
+ * @brief 写入缓存，缓存满时先全部落盘
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 块大小的整数倍
+ * @param offset 块对齐的设备偏移
+ * @param ns 累加本次写触发的落盘时间
+ * @return int 
+ */
+int wcache_write(struct ddriver *dev, int fd, const char *buf, size_t size, off_t offset, int64_t *ns) {
+    off_t blk = offset / DEV_BLOCK_SZ;
+    size_t done;
+    int slot, ret = 0;
+
+    pthread_mutex_lock(&dev->wcache.lock);
+    for (done = 0; done < size; done += DEV_BLOCK_SZ, blk++) {
+        slot = wcache_find(dev, blk);
+        if (slot < 0) {
+            if (dev->wcache.nr_used == dev->wcache.nr_slots && (ret = wcache_destage(dev, fd, ns)) < 0)
+                break;
+            slot = dev->wcache.nr_used++;
+            dev->wcache.blk[slot] = blk;
+            dev->wcache.next[slot] = dev->wcache.hash[blk % dev->wcache.nr_slots];
+            dev->wcache.hash[blk % dev->wcache.nr_slots] = slot;
+            dev->wcache.nr_dirty++;
+        }
+        memcpy(dev->wcache.data + (size_t)slot * DEV_BLOCK_SZ, buf + done, DEV_BLOCK_SZ);
+    }
+    pthread_mutex_unlock(&dev->wcache.lock);
+    return ret;
+}
+/**
+ * @brief 用缓存中的脏块覆盖从介质读出的内容，调用者持有wcache.lock
+ */
+void wcache_overlay(struct ddriver *dev, char *buf, size_t size, off_t offset) {
+    off_t first = offset / DEV_BLOCK_SZ;
+    off_t last = first + size / DEV_BLOCK_SZ;
+    off_t blk;
+    int slot;
+
+    if (dev->wcache.nr_dirty == 0)
+        return;
+    /* 区间比缓存大时按槽位扫描 */
+    if (last - first > dev->wcache.nr_used) {
+        for (slot = 0; slot < dev->wcache.nr_used; slot++) {
+            blk = dev->wcache.blk[slot];
+            if (blk >= first && blk < last)
+                memcpy(buf + (blk - first) * DEV_BLOCK_SZ, dev->wcache.data + (size_t)slot * DEV_BLOCK_SZ, DEV_BLOCK_SZ);
+        }
+        return;
+    }
+    for (blk = first; blk < last; blk++) {
+        if ((slot = wcache_find(dev, blk)) >= 0)
+            memcpy(buf + (blk - first) * DEV_BLOCK_SZ, dev->wcache.data + (size_t)slot * DEV_BLOCK_SZ, DEV_BLOCK_SZ);
+    }
+}
+/**
+ * @brief 检查区间内是否有脏块，调用者持有wcache.lock
+ */
+int wcache_overlaps(struct ddriver *dev, off_t offset, size_t size) {
+    off_t first = offset / DEV_BLOCK_SZ;
+    off_t last = first + size / DEV_BLOCK_SZ;
+    off_t blk;
+    int slot;
+
+    if (dev->wcache.nr_dirty == 0)
+        return 0;
+    if (last - first > dev->wcache.nr_used) {
+        for (slot = 0; slot < dev->wcache.nr_used; slot++) {
+            if (dev->wcache.blk[slot] >= first && dev->wcache.blk[slot] < last)
+                return 1;
+        }
+        return 0;
+    }
+    for (blk = first; blk < last; blk++) {
+        if (wcache_find(dev, blk) >= 0)
+            return 1;
+    }
+    return 0;
+}
+/**
+ * @brief 作废区间内的脏块而不落盘，用于FUA写、丢弃与重置
+ * 
+ * @param offset 
+ * @param size 
+ */
+void wcache_drop(struct ddriver *dev, off_t offset, size_t size) {
+    off_t first = offset / DEV_BLOCK_SZ;
+    off_t last = first + size / DEV_BLOCK_SZ;
+    off_t blk;
+    int slot;
+
+    if (dev->wcache.nr_slots == 0)
+        return;
+    pthread_mutex_lock(&dev->wcache.lock);
+    if (last - first > dev->wcache.nr_used) {
+        for (slot = 0; slot < dev->wcache.nr_used; ) {
+            blk = dev->wcache.blk[slot];
+            if (blk >= first && blk < last)
+                wcache_unlink(dev, slot);   /* 末槽移入slot，原地再查 */
+            else
+                slot++;
+        }
+    }
+    else {
+        for (blk = first; blk < last && dev->wcache.nr_dirty > 0; blk++) {
+            if ((slot = wcache_find(dev, blk)) >= 0)
+                wcache_unlink(dev, slot);
+        }
+    }
+    pthread_mutex_unlock(&dev->wcache.lock);
+}
+/**
+ * @brief 区间内有脏块时将缓存全部落盘，用于绕过缓存直接访问介质之前
+ * 
+ * @param fd 
+ * @param offset 
+ * @param size 
+ * @param ns 累加落盘时间
+ * @return int 
+ */
+int wcache_flush_range(struct ddriver *dev, int fd, off_t offset, size_t size, int64_t *ns) {
+    int ret = 0;
+
+    if (dev->wcache.nr_slots == 0)
+        return 0;
+    pthread_mutex_lock(&dev->wcache.lock);
+    if (wcache_overlaps(dev, offset, size))
+        ret = wcache_destage(dev, fd, ns);
+    pthread_mutex_unlock(&dev->wcache.lock);
+    return ret;
+}
+/**
+ * @brief 将缓存全部落盘，落盘时间由调用者承担
+ * 
+ * @param fd 
+ * @return int 
+ */
+int wcache_flush(struct ddriver *dev, int fd) {
+    int64_t ns = 0;
+    int ret = 0;
+
+    if (dev->wcache.nr_slots == 0)
         return 0;
+    pthread_mutex_lock(&dev->wcache.lock);
+    if (dev->wcache.nr_dirty > 0)
+        ret = wcache_destage(dev, fd, &ns);
+    pthread_mutex_unlock(&dev->wcache.lock);
+    device_sleep(dev, ns);
+    return ret;
+}
+/**
+ * @brief 同步写：开启写缓存且非FUA时写入缓存，只计接口传输时间；否则寻道后直达介质
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @param fua 
+ * @return int 写入字节数或负的错误码
+ */
+int sync_write(struct ddriver *dev, int fd, const char *buf, size_t size, off_t offset, int fua) {
+    struct ddriver_ncq_cmd cmd;
+    int64_t ns = 0;
+    int ret;
+
+    if (dev->wcache.nr_slots > 0 && !fua) {
+        ret = wcache_write(dev, fd, buf, size, offset, &ns);
+        account_vtime(dev, 0, xfer_ns(dev, size));
+        account_io(dev, DDRIVER_OP_WRITE, size, ns + xfer_ns(dev, size));
+        device_sleep(dev, ns + xfer_ns(dev, size));
+        return ret < 0 ? ret : (int)size;
     }
+    /* 直达介质的写使缓存中的旧数据失效 */
+    wcache_drop(dev, offset, size);
+    ncq_enter(dev, &cmd, offset);
+    emulate_io(dev, DDRIVER_OP_WRITE, size, move_head(dev, offset, size));
+    ret = dev_pwrite(dev, fd, buf, size, offset) != (ssize_t)size ? -EIO : (int)size;
+    ncq_leave(dev);
+    return ret;
+}
+/**
+ * @brief 同步读，开启写缓存时用缓存中较新的脏块覆盖介质内容
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @return int 读出字节数或负的错误码
+ */
+int sync_read(struct ddriver *dev, int fd, char *buf, size_t size, off_t offset) {
+    struct ddriver_ncq_cmd cmd;
+    ssize_t ret;
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
-    return 0;
+    ncq_enter(dev, &cmd, offset);
+    emulate_io(dev, DDRIVER_OP_READ, size, move_head(dev, offset, size));
+    if (dev->wcache.nr_slots == 0) {
+        ret = dev_pread(dev, fd, buf, size, offset);
+    }
+    else {
+        /* 读介质与覆盖之间不能有落盘，否则可能读到旧数据 */
+        pthread_mutex_lock(&dev->wcache.lock);
+        ret = dev_pread(dev, fd, buf, size, offset);
+        wcache_overlay(dev, buf, size, offset);
+        pthread_mutex_unlock(&dev->wcache.lock);
+    }
+    ncq_leave(dev);
+    return ret != (ssize_t)size ? -EIO : (int)size;
 }
 /******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
 /**
- * @brief 打开驱动
+ * @brief 打开驱动，每次打开得到一个独立句柄，最多DDRIVER_MAX_HANDLES个；
+ * 路径为~/ddriver或其后加字母数字的兄弟镜像如~/ddriver1，各镜像是独立的设备
  * 
  * @return int 文件描述符
  */
 int ddriver_open(char *path) {
-    int fd, ret = 0;
+    struct ddriver *dev;
+    int fd, i, ret = 0;
+    struct stat st;
     char device_path[128] = {0};
     char log_path[128] = {0};
+    char geo_path[160] = {0};
+    size_t len;
     
+    /* getpwuid不可重入，一并放在锁内 */
+    pthread_mutex_lock(&open_lock);
     sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
     sprintf(log_path, "%s/" DEVICE_LOG, getpwuid(getuid())->pw_dir);
     
-    if (strcmp(device_path, path) != 0) {
-        user_panic("wrong path [%s], should be [%s]", path, device_path);
+    len = strlen(device_path);
+    if (strncmp(device_path, path, len) != 0 || strlen(path) >= sizeof(dev->path)
+        || strspn(path + len, "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ") != strlen(path + len)) {
+        pthread_mutex_unlock(&open_lock);
+        user_panic("wrong path [%s], should be [%s] or [%s<suffix>]", path, device_path, device_path);
         return -1;
     }
+    /* ~/ddriver的旁路文件仍为~/ddriver_geo */
+    sprintf(geo_path, "%s_geo", path);
+
+    for (i = 0; i < DDRIVER_MAX_HANDLES && handles[i].used; i++);
+    if (i == DDRIVER_MAX_HANDLES) {
+        pthread_mutex_unlock(&open_lock);
+        user_panic("too many handles, at most %d", DDRIVER_MAX_HANDLES);
+        return -EMFILE;
+    }
+    dev = device_get(path);
+    if (dev == NULL) {
+        pthread_mutex_unlock(&open_lock);
+        user_panic("too many devices, at most %d", DDRIVER_MAX_DEVICES);
+        return -EMFILE;
+    }
+    /* 后续句柄共享首个句柄确定的设备参数 */
+    if (dev->nr_open == 0 && ((ret = device_setup(dev, geo_path)) < 0 || (ret = wcache_init(dev)) < 0)) {
+        pthread_mutex_unlock(&open_lock);
+        return ret;
+    }
 
-    if (access(device_path, F_OK) == 0) {
-        fd = open(device_path, O_RDWR);
+    if (access(path, F_OK) == 0) {
+        fd = open(path, O_RDWR);
     }
     else {
-        fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+        fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
     }
     if (fd < 0) {
+        if (dev->nr_open == 0)
+            wcache_destroy(dev);
+        pthread_mutex_unlock(&open_lock);
         user_panic("can't open device: %d", fd);
         return fd;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
-    if (ret < 0) {
-        user_panic("low space");
-        return ret;
+    if (dev->nr_open == 0) {
+        /* 只扩展文件长度不预分配，未写过与丢弃过的区间在宿主上保持稀疏 */
+        if (fstat(fd, &st) == 0 && st.st_size < DEV_DISK_SZ)
+            ret = ftruncate(fd, DEV_DISK_SZ);
+        if (ret < 0) {
+            close(fd);
+            wcache_destroy(dev);
+            pthread_mutex_unlock(&open_lock);
+            user_panic("low space");
+            return ret;
+        }
     }
-
-    debugf = fopen(log_path, "w+");
+    /* 日志由所有设备共用 */
     if (debugf == NULL) {
-        user_panic("can't init log: %s", log_path);
-        return -1;
+        debugf = fopen(log_path, "w+");
+        if (debugf == NULL) {
+            close(fd);
+            if (dev->nr_open == 0)
+                wcache_destroy(dev);
+            pthread_mutex_unlock(&open_lock);
+            user_panic("can't init log: %s", log_path);
+            return -1;
+        }
     }
 
+    /* 槽位可能正被handle_get并发扫描，fd须原子写入 */
+    handles[i].dev = dev;
+    handles[i].pos = 0;
+    memset(&handles[i].uring, 0, sizeof(struct ddriver_uring));
+    handles[i].uring.ring_fd = -1;
+    __atomic_store_n(&handles[i].fd, fd, __ATOMIC_RELAXED);
+    __atomic_store_n(&handles[i].used, 1, __ATOMIC_RELEASE);
+    dev->nr_open++;
+    nr_handles++;
+    pthread_mutex_unlock(&open_lock);
     return fd;
 }
 /**
@@ -168,7 +1216,30 @@ int ddriver_open(char *path) {
  * @return int 
  */
 int ddriver_close(int fd) {
-    return close(fd) && fclose(debugf);
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int ret;
+
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+
+    pthread_mutex_lock(&open_lock);
+    uring_teardown(&h->uring);
+    __atomic_store_n(&h->used, 0, __ATOMIC_RELEASE);
+    /* 写缓存与映射由设备的所有句柄共享，最后一个句柄关闭时才落盘并撤掉 */
+    if (--dev->nr_open == 0) {
+        wcache_flush(dev, fd);
+        wcache_destroy(dev);
+        set_backend(dev, fd, DDRIVER_BACKEND_FILE);
+    }
+    if (--nr_handles == 0) {
+        fclose(debugf);
+        debugf = NULL;
+    }
+    ret = close(fd);
+    pthread_mutex_unlock(&open_lock);
+    return ret;
 }
 /**
  * @brief 磁盘头SEEK
@@ -179,24 +1250,32 @@ int ddriver_close(int fd) {
  * @return int 
  */
 int ddriver_seek(int fd, off_t offset, int whence){
-    int ret = 0;
-    int cur = 0;
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    off_t cur;
+
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+
+    if (whence == SEEK_CUR) {
+        offset += h->pos;
+    }
+    else if (whence == SEEK_END) {
+        offset += DEV_DISK_SZ;
+    }
 
     if (!IS_ADDR_ALIGN(offset)) {
         user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, DEV_BLOCK_SZ);
         return -EINVAL;
     }
 
-    INC_SEEKCNT(disk);
-    cur = lseek(fd, 0, SEEK_CUR);
-    ret = lseek(fd, offset, whence);
-    if (ret < 0) {
-        user_panic("seek error: %s", strerror(errno));
-        return ret;
-    }
-    emulate_rotate(fd, cur, ret);
-    return ret;
+    cur = __atomic_exchange_n(&dev->head, offset, __ATOMIC_RELAXED);
+    account_seek(dev, cur, offset);
+    h->pos = offset;
+    emulate_delay(dev, rotate_lat_ns(dev, cur, offset), 0);
+    return offset;
 }
 /**
  * @brief 磁盘写入，写入大小可通过IOCTL查询
@@ -207,15 +1286,27 @@ int ddriver_seek(int fd, off_t offset, int whence){
  * @return int 
  */
 int ddriver_write(int fd, char *buf, size_t size){
-    int res = check_valid(size);
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int res;
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    res = check_valid(dev, size);
+    if(res < 0)
+        return res;
+    res = check_valid_range(dev, h->pos, size);
     if(res < 0)
         return res;
-        
-    RW_DELAY(disk, write);
-    write(fd, buf, size);
 
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    /* 句柄位置与磁头不一致说明期间有其他请求移动过磁头 */
+    if (sync_write(dev, fd, buf, size, h->pos, 0) < 0) {
+        user_panic("write error: %s", strerror(errno));
+        return -EIO;
+    }
+    h->pos += size;
+
+    return DEV_BLOCK_SZ;
 }
 /**
  * @brief 
@@ -226,15 +1317,169 @@ int ddriver_write(int fd, char *buf, size_t size){
  * @return int 
  */
 int ddriver_read(int fd, char *buf, size_t size){
-    int res = check_valid(size);
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int res;
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    res = check_valid(dev, size);
+    if(res < 0)
+        return res;
+    res = check_valid_range(dev, h->pos, size);
+    if(res < 0)
+        return res;
+
+    /* 句柄位置与磁头不一致说明期间有其他请求移动过磁头 */
+    if (sync_read(dev, fd, buf, size, h->pos) < 0) {
+        user_panic("read error: %s", strerror(errno));
+        return -EIO;
+    }
+    h->pos += size;
+
+    return DEV_BLOCK_SZ;
+}
+/**
+ * @brief 连续写入多个块，整个请求只计一次写延迟与一次写计数
+ * 
+ * @param fd 
+ * @param buf 
+ * @param blk_cnt 块数，每块大小为DEV_BLOCK_SZ
+ * @return int 写入字节数
+ */
+int ddriver_write_blocks(int fd, char *buf, int blk_cnt){
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int res;
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    res = check_valid_blocks(dev, blk_cnt);
+    if(res < 0)
+        return res;
+    res = check_valid_range(dev, h->pos, (size_t)blk_cnt * DEV_BLOCK_SZ);
+    if(res < 0)
+        return res;
+
+    if (sync_write(dev, fd, buf, (size_t)blk_cnt * DEV_BLOCK_SZ, h->pos, 0) < 0) {
+        user_panic("write error: %s", strerror(errno));
+        return -EIO;
+    }
+    h->pos += (off_t)blk_cnt * DEV_BLOCK_SZ;
+
+    return blk_cnt * DEV_BLOCK_SZ;
+}
+/**
+ * @brief 连续读出多个块，整个请求只计一次读延迟与一次读计数
+ * 
+ * @param fd 
+ * @param buf 
+ * @param blk_cnt 块数，每块大小为DEV_BLOCK_SZ
+ * @return int 读出字节数
+ */
+int ddriver_read_blocks(int fd, char *buf, int blk_cnt){
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int res;
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    res = check_valid_blocks(dev, blk_cnt);
+    if(res < 0)
+        return res;
+    res = check_valid_range(dev, h->pos, (size_t)blk_cnt * DEV_BLOCK_SZ);
+    if(res < 0)
+        return res;
+
+    if (sync_read(dev, fd, buf, (size_t)blk_cnt * DEV_BLOCK_SZ, h->pos) < 0) {
+        user_panic("read error: %s", strerror(errno));
+        return -EIO;
+    }
+    h->pos += (off_t)blk_cnt * DEV_BLOCK_SZ;
+
+    return blk_cnt * DEV_BLOCK_SZ;
+}
+/**
+ * @brief 定位写，不依赖也不修改文件偏移，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 块大小的整数倍
+ * @param offset 块对齐的设备偏移
+ * @return int 写入字节数
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int res;
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    res = check_valid_range(dev, offset, size);
+    if(res < 0)
+        return res;
+
+    if (sync_write(dev, fd, buf, size, offset, 0) < 0) {
+        user_panic("pwrite error: %s", strerror(errno));
+        return -EIO;
+    }
+
+    return size;
+}
+/**
+ * @brief FUA定位写，绕过写缓存直达介质后才返回，不影响缓存中其他块
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 块大小的整数倍
+ * @param offset 块对齐的设备偏移
+ * @return int 写入字节数
+ */
+int ddriver_pwrite_fua(int fd, char *buf, size_t size, off_t offset){
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int res;
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    res = check_valid_range(dev, offset, size);
+    if(res < 0)
+        return res;
+
+    STAT_ADD(fua_cnt, 1);
+    if (sync_write(dev, fd, buf, size, offset, 1) < 0) {
+        user_panic("pwrite error: %s", strerror(errno));
+        return -EIO;
+    }
+
+    return size;
+}
+/**
+ * @brief 定位读，不依赖也不修改文件偏移，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 块大小的整数倍
+ * @param offset 块对齐的设备偏移
+ * @return int 读出字节数
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int res;
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    res = check_valid_range(dev, offset, size);
     if(res < 0)
         return res;
 
-    RW_DELAY(disk, read);
-    read(fd, buf, size);
+    if (sync_read(dev, fd, buf, size, offset) < 0) {
+        user_panic("pread error: %s", strerror(errno));
+        return -EIO;
+    }
 
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return size;
 }
 /**
  * @brief 
@@ -245,35 +1490,485 @@ int ddriver_read(int fd, char *buf, size_t size){
  * @return int 
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
+    struct ddriver_handle *h = handle_get(fd);
     struct ddriver_state state;
+    struct ddriver *dev;
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+    {
+        /* int放不下时报告可用的最大对齐容量 */
+        int size = dev->layout_size > INT_MAX ? 
+                   INT_MAX / dev->iounit_size * dev->iounit_size : (int)dev->layout_size;
+        memcpy(arg, &size, sizeof(int));
         break;
+    }
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = __atomic_load_n(&dev->stats.read_cnt, __ATOMIC_RELAXED);
+        state.write_cnt = __atomic_load_n(&dev->stats.write_cnt, __ATOMIC_RELAXED);
+        state.seek_cnt = __atomic_load_n(&dev->stats.seek_cnt, __ATOMIC_RELAXED);
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
-        {
-            write(fd, buf, 4096);
-        }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+    {
+        wcache_drop(dev, 0, DEV_DISK_SZ);
+        punch_hole(dev, fd, 0, DEV_DISK_SZ);
+        __atomic_store_n(&dev->head, 0, __ATOMIC_RELAXED);
+        h->pos = 0;
+        stats_reset(dev);
+        break;
+    }
+    case IOC_REQ_DEVICE_STATS:                        /* Device Statistics */
+        stats_snapshot(dev, (struct ddriver_stats *)arg);
+        break;
+    case IOC_REQ_DEVICE_RESET_STATS:                  /* Reset Statistics, keep contents */
+        stats_reset(dev);
+        break;
+    case IOC_REQ_DEVICE_DISCARD:                      /* Discard/TRIM */
+    {
+        struct ddriver_discard *discard = (struct ddriver_discard *)arg;
+        int ret = check_valid_range(dev, discard->offset, discard->len);
+        if (ret < 0)
+            return ret;
+        wcache_drop(dev, discard->offset, discard->len);
+        ret = punch_hole(dev, fd, discard->offset, discard->len);
+        if (ret < 0)
+            return ret;
+        STAT_ADD(discard_cnt, 1);
+        STAT_ADD(discard_bytes, discard->len);
         break;
+    }
+    case IOC_REQ_DEVICE_FLUSH:                        /* Flush Write Cache */
+        STAT_ADD(flush_cnt, 1);
+        return wcache_flush(dev, fd);
+    case IOC_REQ_DEVICE_POS_COST:                     /* Positioning Cost, for mirror read balancing */
+    {
+        struct ddriver_pos_cost *pos = (struct ddriver_pos_cost *)arg;
+        pos->head = __atomic_load_n(&dev->head, __ATOMIC_RELAXED);
+        pos->cost_ns = pos->head == pos->offset ? 0 : rotate_lat_ns(dev, pos->head, pos->offset);
+        break;
+    }
     case IOC_REQ_DEVICE_IO_SZ:
-        memcpy(arg, &disk.iounit_size, sizeof(int));
+        memcpy(arg, &dev->iounit_size, sizeof(int));
         break;
+    case IOC_REQ_DEVICE_VTIME:
+    {
+        struct ddriver_vtime vtime;
+        vtime.seek_ns = __atomic_load_n(&dev->vtime_seek_ns, __ATOMIC_RELAXED);
+        vtime.rw_ns = __atomic_load_n(&dev->vtime_rw_ns, __ATOMIC_RELAXED);
+        vtime.total_ns = vtime.seek_ns + vtime.rw_ns;
+        vtime.profile = dev->profile;
+        vtime.clock = dev->clock;
+        memcpy(arg, &vtime, sizeof(struct ddriver_vtime));
+        break;
+    }
+    case IOC_REQ_DEVICE_SIZE64:
+    {
+        int64_t size = dev->layout_size;
+        memcpy(arg, &size, sizeof(int64_t));
+        break;
+    }
+    case IOC_REQ_DEVICE_BACKEND:
+    {
+        int ret;
+        pthread_mutex_lock(&open_lock);
+        ret = set_backend(dev, fd, *(int *)arg);
+        pthread_mutex_unlock(&open_lock);
+        return ret;
+    }
     default:
         break;
     }
     return 0;
-}
\ No newline at end of file
+}
+/**
+ * @brief 返回设备区间在映射中的地址，按一次读/写请求计数与计延迟
+ * 
+ * @param fd 
+ * @param offset 块对齐的设备偏移
+ * @param size 块大小的整数倍
+ * @param flags DDRIVER_MAP_READ / DDRIVER_MAP_WRITE
+ * @return char* 非MMAP后端或区间非法时返回NULL
+ */
+char *ddriver_map_block(int fd, off_t offset, size_t size, int flags){
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int64_t ns = 0;
+
+    if (h == NULL)
+        return NULL;
+    dev = h->dev;
+    if (dev->backend != DDRIVER_BACKEND_MMAP || check_valid_range(dev, offset, size) < 0)
+        return NULL;
+
+    /* 调用者直接访问映射，区间内的脏块须先落盘 */
+    if (wcache_flush_range(dev, fd, offset, size, &ns) < 0)
+        return NULL;
+    device_sleep(dev, ns);
+
+    emulate_io(dev, flags & DDRIVER_MAP_WRITE ? DDRIVER_OP_WRITE : DDRIVER_OP_READ, 
+               size, move_head(dev, offset, size));
+    return dev->map + offset;
+}
+/**
+ * @brief 将已写入的数据持久化到后备文件
+ * 
+ * @param fd 
+ * @return int 
+ */
+int ddriver_sync(int fd){
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    int ret;
+
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    if (wcache_flush(dev, fd) < 0)
+        return -EIO;
+    if (dev->backend == DDRIVER_BACKEND_MMAP)
+        ret = msync(dev->map, DEV_DISK_SZ, MS_SYNC);
+    else
+        ret = fdatasync(fd);
+    return ret < 0 ? -errno : 0;
+}
+/******************************************************************************
+* SECTION: Async IO
+*******************************************************************************/
+int uring_setup(struct ddriver_uring *uring) {
+    struct io_uring_params p;
+    int ring_fd;
+
+    memset(&p, 0, sizeof(p));
+    ring_fd = syscall(__NR_io_uring_setup, DDRIVER_QUEUE_DEPTH, &p);
+    if (ring_fd < 0) {
+        user_alert("io_uring unavailable (%s), fall back to sync io", strerror(errno));
+        uring->state = 2;
+        return 0;
+    }
+
+    uring->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    uring->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_sz > uring->sq_sz)
+            uring->sq_sz = uring->cq_sz;
+        uring->cq_sz = uring->sq_sz;
+    }
+    uring->sq_ptr = mmap(0, uring->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ptr == MAP_FAILED) {
+        close(ring_fd);
+        uring->state = 2;
+        return 0;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_ptr = uring->sq_ptr;
+    }
+    else {
+        uring->cq_ptr = mmap(0, uring->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring_fd, IORING_OFF_CQ_RING);
+        if (uring->cq_ptr == MAP_FAILED) {
+            munmap(uring->sq_ptr, uring->sq_sz);
+            close(ring_fd);
+            uring->state = 2;
+            return 0;
+        }
+    }
+    uring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(0, uring->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        if (uring->cq_ptr != uring->sq_ptr)
+            munmap(uring->cq_ptr, uring->cq_sz);
+        munmap(uring->sq_ptr, uring->sq_sz);
+        close(ring_fd);
+        uring->state = 2;
+        return 0;
+    }
+
+    uring->sq_tail  = (unsigned *)((char *)uring->sq_ptr + p.sq_off.tail);
+    uring->sq_mask  = (unsigned *)((char *)uring->sq_ptr + p.sq_off.ring_mask);
+    uring->sq_array = (unsigned *)((char *)uring->sq_ptr + p.sq_off.array);
+    uring->cq_head  = (unsigned *)((char *)uring->cq_ptr + p.cq_off.head);
+    uring->cq_tail  = (unsigned *)((char *)uring->cq_ptr + p.cq_off.tail);
+    uring->cq_mask  = (unsigned *)((char *)uring->cq_ptr + p.cq_off.ring_mask);
+    uring->cqes     = (struct io_uring_cqe *)((char *)uring->cq_ptr + p.cq_off.cqes);
+    uring->entries  = p.sq_entries;
+    uring->ring_fd  = ring_fd;
+    uring->state    = 1;
+    return 0;
+}
+
+/**
+ * @brief 将请求按其模拟延迟排到设备时间线上，得出完成时刻
+ * 
+ * @param req 
+ * @param lat_ns 
+ */
+void uring_schedule(struct ddriver *dev, struct ddriver_req *req, int64_t lat_ns) {
+    long lat = lat_ns / 1000;
+    long start = now_us();
+    long busy;
+
+    req->lat_us = lat;
+    /* 虚拟时钟下只累计设备时间，内核完成即可收割 */
+    if (dev->clock == DDRIVER_CLOCK_VIRTUAL) {
+        req->due_us = start;
+        return;
+    }
+    /* 各句柄的请求排在同一条设备时间线上 */
+    busy = __atomic_load_n(&dev->busy_until_us, __ATOMIC_RELAXED);
+    do {
+        req->due_us = (busy > start ? busy : start) + lat;
+    } while (!__atomic_compare_exchange_n(&dev->busy_until_us, &busy, req->due_us, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief 为请求计算模拟延迟并排到设备时间线上，同时更新磁头与计数
+ * 
+ * @param req 
+ * @param pre_ns 请求开始前设备已忙的时间，如写缓存落盘
+ */
+void uring_model(struct ddriver *dev, struct ddriver_req *req, int64_t pre_ns) {
+    int op = req->op & DDRIVER_OP_MASK;
+    off_t cur = __atomic_exchange_n(&dev->head, req->offset + req->size, __ATOMIC_RELAXED);
+    int64_t seek_ns = rotate_lat_ns(dev, cur, req->offset);
+    int64_t rw_ns = access_lat_ns(dev, op, req->size);
+
+    if (cur != req->offset) {
+        account_seek(dev, cur, req->offset);
+    }
+
+    account_vtime(dev, seek_ns, rw_ns);
+    account_io(dev, op, req->size, pre_ns + seek_ns + rw_ns);
+    uring_schedule(dev, req, pre_ns + seek_ns + rw_ns);
+}
+
+/**
+ * @brief 为一批同时到达的请求建模，开启命令队列时按设备的派发顺序而非提交顺序
+ * 
+ * @param reqs 
+ * @param pre_ns 各请求开始前设备已忙的时间
+ * @param nr 
+ */
+void ncq_model(struct ddriver *dev, struct ddriver_req *reqs[], int64_t pre_ns[], int nr) {
+    struct ddriver_ncq_cmd cmds[DDRIVER_QUEUE_DEPTH];
+    struct ddriver_ncq_cmd *queue[DDRIVER_NCQ_MAX_DEPTH];
+    int next = 0, n = 0, i, k;
+
+    if (dev->ncq_depth == 0) {
+        for (i = 0; i < nr; i++)
+            uring_model(dev, reqs[i], pre_ns[i]);
+        return;
+    }
+    for (i = 0; i < nr; i++) {
+        cmds[i].offset = reqs[i]->offset;
+        cmds[i].seq = i;
+        cmds[i].skipped = 0;
+    }
+    while (next < nr || n > 0) {
+        while (n < dev->ncq_depth && next < nr)
+            queue[n++] = &cmds[next++];
+        i = ncq_choose(dev, queue, n);
+        k = queue[i]->seq;
+        queue[i] = queue[--n];
+        uring_model(dev, reqs[k], pre_ns[k]);
+    }
+}
+
+void uring_reap(struct ddriver_uring *uring) {
+    unsigned head = *uring->cq_head;
+    unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe;
+    struct ddriver_req *req;
+
+    while (head != tail) {
+        cqe = &uring->cqes[head & *uring->cq_mask];
+        req = (struct ddriver_req *)(uintptr_t)cqe->user_data;
+        req->res = cqe->res;
+        uring->pending[uring->nr_pending++] = req;
+        uring->inflight--;
+        head++;
+    }
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
+/**
+ * @brief 异步提交一批块请求
+ * 
+ * @param fd 
+ * @param reqs 
+ * @param nr 
+ * @return int 实际提交个数，内核拒收的请求以负的res完成，照常由ddriver_wait收割
+ */
+int ddriver_submit(int fd, struct ddriver_req *reqs[], int nr) {
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver *dev;
+    struct ddriver_uring *uring;
+    struct io_uring_sqe *sqe;
+    struct ddriver_req *req;
+    struct ddriver_req *media[DDRIVER_QUEUE_DEPTH];
+    int64_t media_ns[DDRIVER_QUEUE_DEPTH];
+    unsigned tail;
+    unsigned idx;
+    int64_t pre_ns;
+    int room, nr_media = 0, nr_sqe = 0;
+    int i, op, ret, err;
+
+    if (h == NULL)
+        return -EBADF;
+    dev = h->dev;
+    uring = &h->uring;
+    room = DDRIVER_QUEUE_DEPTH - uring->inflight - uring->nr_pending;
+    if (uring->state == 0) {
+        uring_setup(uring);
+    }
+    if (nr > room) {
+        nr = room;
+    }
+
+    for (i = 0; i < nr; i++) {
+        req = reqs[i];
+        ret = check_valid_range(dev, req->offset, req->size);
+        if (ret < 0) {
+            nr = i;
+            break;
+        }
+        op = req->op & DDRIVER_OP_MASK;
+        pre_ns = 0;
+        if (req->op & DDRIVER_OP_FUA) {
+            STAT_ADD(fua_cnt, 1);
+        }
+        if (dev->wcache.nr_slots > 0 && op == DDRIVER_OP_WRITE && !(req->op & DDRIVER_OP_FUA)) {
+            /* 写入设备缓存即完成，不经内核 */
+            ret = wcache_write(dev, fd, req->buf, req->size, req->offset, &pre_ns);
+            req->res = ret < 0 ? ret : (int)req->size;
+            account_vtime(dev, 0, xfer_ns(dev, req->size));
+            account_io(dev, op, req->size, pre_ns + xfer_ns(dev, req->size));
+            uring_schedule(dev, req, pre_ns + xfer_ns(dev, req->size));
+            uring->pending[uring->nr_pending++] = req;
+            continue;
+        }
+        /* 读须看到缓存中的脏块，直达介质的写使其失效 */
+        if (op == DDRIVER_OP_READ && wcache_flush_range(dev, fd, req->offset, req->size, &pre_ns) < 0) {
+            nr = i;
+            break;
+        }
+        if (op == DDRIVER_OP_WRITE) {
+            wcache_drop(dev, req->offset, req->size);
+        }
+        /* 到达介质的请求在批末统一建模，完成时刻在返回前确定 */
+        media[nr_media] = req;
+        media_ns[nr_media++] = pre_ns;
+
+        if (uring->state == 2) {
+            req->res = op == DDRIVER_OP_READ ? 
+                       dev_pread(dev, fd, req->buf, req->size, req->offset) :
+                       dev_pwrite(dev, fd, req->buf, req->size, req->offset);
+            if (req->res < 0) {
+                req->res = -errno;
+            }
+            uring->pending[uring->nr_pending++] = req;
+            continue;
+        }
+
+        tail = *uring->sq_tail;
+        idx = tail & *uring->sq_mask;
+        sqe = &uring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = op == DDRIVER_OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = req->size;
+        sqe->off = req->offset;
+        sqe->user_data = (uint64_t)(uintptr_t)req;
+        uring->sq_array[idx] = idx;
+        __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        uring->inflight++;
+        nr_sqe++;
+    }
+    ncq_model(dev, media, media_ns, nr_media);
+
+    /* 缓存吸收的写不占SQE，只把入队的交给内核 */
+    while (uring->state == 1 && nr_sqe > 0) {
+        ret = syscall(__NR_io_uring_enter, uring->ring_fd, nr_sqe, 0, 0, NULL, 0);
+        err = ret < 0 ? errno : EAGAIN;
+        if (ret > 0) {
+            nr_sqe -= ret;
+            continue;
+        }
+        if (err == EINTR) {
+            continue;
+        }
+        user_panic("io_uring_enter error: %s", strerror(err));
+        /* 内核未取走的SQE退出队列，按失败完成 */
+        tail = *uring->sq_tail - nr_sqe;
+        for (i = 0; i < nr_sqe; i++) {
+            req = (struct ddriver_req *)(uintptr_t)uring->sqes[(tail + i) & *uring->sq_mask].user_data;
+            req->res = -err;
+            uring->pending[uring->nr_pending++] = req;
+        }
+        __atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+        uring->inflight -= nr_sqe;
+        break;
+    }
+    return nr;
+}
+/**
+ * @brief 收割已完成的请求；内核完成后还需等到模拟完成时刻才交给调用者
+ * 
+ * @param fd 
+ * @param done 
+ * @param min_nr 
+ * @param max_nr 
+ * @return int 完成个数
+ */
+int ddriver_wait(int fd, struct ddriver_req *done[], int min_nr, int max_nr) {
+    struct ddriver_handle *h = handle_get(fd);
+    struct ddriver_uring *uring;
+    struct ddriver_req *req;
+    long now, earliest;
+    int nr_done = 0;
+    int i;
+
+    if (h == NULL)
+        return -EBADF;
+    uring = &h->uring;
+    if (min_nr > max_nr) {
+        min_nr = max_nr;
+    }
+
+    while (1) {
+        if (uring->state == 1) {
+            uring_reap(uring);
+        }
+
+        now = now_us();
+        earliest = -1;
+        for (i = 0; i < uring->nr_pending && nr_done < max_nr; ) {
+            req = uring->pending[i];
+            if (req->due_us <= now) {
+                done[nr_done++] = req;
+                uring->pending[i] = uring->pending[--uring->nr_pending];
+                continue;
+            }
+            if (earliest < 0 || req->due_us < earliest) {
+                earliest = req->due_us;
+            }
+            i++;
+        }
+
+        if (nr_done >= min_nr || (uring->nr_pending == 0 && uring->inflight == 0)) {
+            return nr_done;
+        }
+        if (uring->nr_pending > 0 && (uring->inflight == 0 || nr_done + uring->nr_pending >= min_nr)) {
+            usleep(earliest - now);
+        }
+        else if (uring->inflight > 0) {
+            syscall(__NR_io_uring_enter, uring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        }
+    }
+}
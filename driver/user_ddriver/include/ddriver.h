@@ -8,7 +8,16 @@ int ddriver_open(char *path);
 int ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_write_blocks(int fd, char *buf, int blk_cnt);
+int ddriver_read_blocks(int fd, char *buf, int blk_cnt);
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pwrite_fua(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+int ddriver_submit(int fd, struct ddriver_req *reqs[], int nr);
+int ddriver_wait(int fd, struct ddriver_req *done[], int min_nr, int max_nr);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
+char *ddriver_map_block(int fd, off_t offset, size_t size, int flags);
+int ddriver_sync(int fd);
 int ddriver_close(int fd);
 
 #endif /* _DDRIVER_H_ */
\ No newline at end of file
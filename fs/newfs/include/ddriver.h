@@ -5,7 +5,9 @@
 #include "stdio.h"
 
 /**
- * @brief 打开ddriver设备
+ * @brief 打开ddriver设备，可多次打开得到多个句柄供不同线程并发使用，
+ * 各句柄的顺序读写位置与异步队列相互独立；~/ddriver之外还可打开~/ddriver1等
+ * 同级镜像，每个镜像是一台独立的设备，几何参数存于各自的<path>_geo
  * 
  * @param path ddriver设备路径
  * @return int 0成功，否则失败
@@ -42,6 +44,80 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 连续写入多个块，一次请求只付一次写延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param blk_cnt 要写入的块数，单块大小为设备IO单位
+ * @return int 写入字节数，负数表示失败
+ */
+int ddriver_write_blocks(int fd, char *buf, int blk_cnt);
+
+/**
+ * @brief 连续读出多个块，一次请求只付一次读延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param blk_cnt 要读出的块数，单块大小为设备IO单位
+ * @return int 读出字节数，负数表示失败
+ */
+int ddriver_read_blocks(int fd, char *buf, int blk_cnt);
+
+/**
+ * @brief 定位写，无需先ddriver_seek，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，须为设备IO单位的整数倍
+ * @param offset 写入位置，须与设备IO单位对齐
+ * @return int 写入字节数，负数表示失败
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 强制直达介质的定位写(FUA)，返回时数据已不在设备写缓存中
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，须为设备IO单位的整数倍
+ * @param offset 写入位置，须与设备IO单位对齐
+ * @return int 写入字节数，负数表示失败
+ */
+int ddriver_pwrite_fua(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 定位读，无需先ddriver_seek，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，须为设备IO单位的整数倍
+ * @param offset 读取位置，须与设备IO单位对齐
+ * @return int 读出字节数，负数表示失败
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 异步提交一批请求，立即返回，模拟延迟不在调用者线程中睡眠
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求指针数组，请求在完成前须保持有效
+ * @param nr 请求个数
+ * @return int 实际提交的个数（受DDRIVER_QUEUE_DEPTH限制），负数表示失败
+ */
+int ddriver_submit(int fd, struct ddriver_req *reqs[], int nr);
+
+/**
+ * @brief 收割已完成的异步请求，请求在其模拟完成时刻之后才算完成
+ * 
+ * @param fd ddriver设备handler
+ * @param done 返回已完成请求的指针
+ * @param min_nr 至少等待完成的个数，0表示不阻塞
+ * @param max_nr done数组容量
+ * @return int 完成的个数，无在途请求时可能少于min_nr
+ */
+int ddriver_wait(int fd, struct ddriver_req *done[], int min_nr, int max_nr);
+
 /**
  * @brief ddriver IO控制
  * 
@@ -52,6 +128,25 @@ int ddriver_read(int fd, char *buf, size_t size);
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 
+/**
+ * @brief 在MMAP后端下直接取得设备区间的内存地址，免去一次拷贝
+ * 
+ * @param fd ddriver设备handler
+ * @param offset 区间起点，须与设备IO单位对齐
+ * @param size 区间大小，须为设备IO单位的整数倍
+ * @param flags DDRIVER_MAP_READ只读访问，DDRIVER_MAP_WRITE将写入该区间
+ * @return char* 区间地址，映射常驻至ddriver_close；非MMAP后端返回NULL
+ */
+char *ddriver_map_block(int fd, off_t offset, size_t size, int flags);
+
+/**
+ * @brief 先将设备写缓存落盘，再持久化已写入的数据，MMAP后端为msync，文件后端为fdatasync
+ * 
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
+int ddriver_sync(int fd);
+
 /**
  * @brief 关闭ddriver设备
  * 
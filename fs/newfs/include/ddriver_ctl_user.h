@@ -2,6 +2,8 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/types.h>
+#include <stdint.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -17,5 +19,97 @@ struct ddriver_state
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_REQ_DEVICE_BACKEND  _IOW(IOC_MAGIC, 4, int)                     /* 切换设备后端，参数为 DDRIVER_BACKEND_* */
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 5, int64_t)                 /* 请求64位设备大小 */
+#define IOC_REQ_DEVICE_VTIME    _IOR(IOC_MAGIC, 6, struct ddriver_vtime)    /* 请求累计的模拟设备时间 */
+#define IOC_REQ_DEVICE_STATS    _IOR(IOC_MAGIC, 7, struct ddriver_stats)    /* 请求64位统计，返回 ddriver_stats */
+#define IOC_REQ_DEVICE_RESET_STATS _IO(IOC_MAGIC, 8)                        /* 清零统计与模拟时间，不改动设备内容 */
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 9, struct ddriver_discard) /* 丢弃设备区间，之后读出全零 */
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 10)                          /* 将设备写缓存中的脏块全部落盘 */
+#define IOC_REQ_DEVICE_POS_COST _IOWR(IOC_MAGIC, 11, struct ddriver_pos_cost) /* 查询磁头定位到某偏移的模拟时间 */
+
+#define DDRIVER_LAT_BUCKETS     32                                          /* 桶0: <1us, 桶i: [2^(i-1), 2^i) us */
+
+struct ddriver_stats
+{
+    uint64_t read_cnt;
+    uint64_t write_cnt;
+    uint64_t seek_cnt;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t seek_distance;                         /* 累计寻道距离(字节) */
+    uint64_t read_lat_hist[DDRIVER_LAT_BUCKETS];    /* 按模拟延迟分桶的请求数 */
+    uint64_t write_lat_hist[DDRIVER_LAT_BUCKETS];
+    uint64_t discard_cnt;
+    uint64_t discard_bytes;
+    uint64_t flush_cnt;
+    uint64_t fua_cnt;
+    uint64_t destage_cnt;                           /* 写缓存落盘的介质写次数 */
+    uint64_t destage_bytes;
+    uint64_t ncq_cmd_cnt;                           /* 经设备命令队列派发的命令数 */
+    uint64_t ncq_depth_sum;                         /* 派发时队列中的命令数之和，除以ncq_cmd_cnt得平均深度 */
+    uint64_t ncq_depth_max;
+    uint64_t ncq_reorder_cnt;                       /* 越过更早到达的命令被派发的次数 */
+    uint64_t ncq_saved_ns;                          /* 相比按到达顺序派发节省的定位时间 */
+};
+
+struct ddriver_discard
+{
+    int64_t offset;                                 /* 块对齐的设备偏移 */
+    int64_t len;                                    /* 块大小的整数倍 */
+};
+
+struct ddriver_pos_cost
+{
+    int64_t offset;                                 /* 输入: 目标偏移 */
+    int64_t head;                                   /* 输出: 磁头当前位置 */
+    int64_t cost_ns;                                /* 输出: 按旋转模型从磁头定位到offset的时间 */
+};
+
+#define DDRIVER_PROFILE_HDD     0
+#define DDRIVER_PROFILE_SSD     1
+#define DDRIVER_PROFILE_NVME    2
+#define DDRIVER_PROFILE_ZERO    3
+#define DDRIVER_PROFILE_CUSTOM  4                                           /* 由DDRIVER_*_LAT单独指定 */
+
+#define DDRIVER_CLOCK_REAL      0                                           /* 按模拟延迟真实睡眠 */
+#define DDRIVER_CLOCK_VIRTUAL   1                                           /* 只累计模拟时间，不睡眠 */
+
+struct ddriver_vtime
+{
+    int64_t total_ns;       /* 累计的模拟设备时间 */
+    int64_t seek_ns;        /* 其中寻道与旋转 */
+    int64_t rw_ns;          /* 其中访问延迟与传输 */
+    int     profile;        /* DDRIVER_PROFILE_* */
+    int     clock;          /* DDRIVER_CLOCK_* */
+};
+
+#define DDRIVER_BACKEND_FILE    0                                           /* pread/pwrite后备文件 */
+#define DDRIVER_BACKEND_MMAP    1                                           /* 共享映射，支持ddriver_map_block */
+
+#define DDRIVER_MAP_READ        0x1
+#define DDRIVER_MAP_WRITE       0x2
+
+/******************************************************************************
+* SECTION: Async IO protocol definitions
+*******************************************************************************/
+#define DDRIVER_OP_READ         0
+#define DDRIVER_OP_WRITE        1
+#define DDRIVER_OP_FUA          0x100                                       /* 与DDRIVER_OP_WRITE按位或，绕过写缓存直达介质 */
+#define DDRIVER_OP_MASK         0xff
+#define DDRIVER_QUEUE_DEPTH     64                                          /* 最大在途请求数 */
+#define DDRIVER_NCQ_MAX_DEPTH   32                                          /* 设备命令队列深度上限 */
+
+struct ddriver_req
+{
+    int    op;              /* DDRIVER_OP_READ / DDRIVER_OP_WRITE [| DDRIVER_OP_FUA] */
+    char  *buf;
+    size_t size;            /* 块大小的整数倍 */
+    off_t  offset;          /* 块对齐的设备偏移 */
+    int    res;             /* 完成后: 传输字节数或负的错误码 */
+    long   lat_us;          /* 该请求的模拟设备延迟 */
+    long   due_us;          /* 驱动内部使用: 模拟的完成时刻 */
+    void  *private;         /* 调用者私有数据 */
+};
 
 #endif
\ No newline at end of file
@@ -10,8 +10,10 @@
 #include "string.h"
 #include "fuse.h"
 #include <stddef.h>
+#include <limits.h>
 #include "ddriver.h"
 #include "errno.h"
+#include <pthread.h>
 #include "types.h"
 
 #define NEWFS_MAGIC				/* TODO: Define by yourself */
@@ -29,8 +31,14 @@
 char *
 newfs_get_fname(const char *path);
 int newfs_calc_lvl(const char *path);
-int newfs_driver_read(int offset, uint8_t *out_content, int size);
-int newfs_driver_write(int offset, uint8_t *in_content, int size);
+int newfs_driver_read(int64_t offset, uint8_t *out_content, int size);
+int newfs_driver_write(int64_t offset, uint8_t *in_content, int size);
+const uint8_t *newfs_driver_peek(int64_t offset, int size, uint8_t *fallback);
+int newfs_driver_sync();
+int newfs_dev_read(int64_t offset, uint8_t *out_content, int size);
+int newfs_dev_write(int64_t offset, uint8_t *in_content, int size);
+int newfs_dev_read_units(int64_t offset_aligned, uint8_t *buf, int unit_cnt);
+int newfs_dev_write_units(int64_t offset_aligned, uint8_t *buf, int unit_cnt);
 
 int newfs_mount(struct custom_options options);
 int newfs_umount();
@@ -46,6 +54,88 @@ struct newfs_dentry *newfs_get_dentry(struct newfs_inode *inode, int dir);
 int newfs_read_file(struct newfs_inode *inode, char *data, int length, int offset);
 int newfs_write_file(struct newfs_inode *inode, const char *data, int length, int offset);
 struct newfs_dentry *newfs_lookup(const char *path, boolean *is_find, boolean *is_root);
+/******************************************************************************
+ * SECTION: newfs_cache.c
+ *******************************************************************************/
+int newfs_cache_init(int cache_kb);
+int newfs_cache_read(int64_t offset, uint8_t *out_content, int size);
+int newfs_cache_write(int64_t offset, uint8_t *in_content, int size);
+int newfs_cache_flush();
+void newfs_cache_invalidate(int64_t blk, int64_t blk_cnt);
+void newfs_cache_destroy();
+/******************************************************************************
+ * SECTION: newfs_sched.c
+ *******************************************************************************/
+int newfs_sched_submit_write(int64_t offset, uint8_t *buf, int size);
+int newfs_sched_dispatch();
+int newfs_sched_submit_discard(int64_t dno);
+int newfs_sched_discard();
+void newfs_sched_destroy();
+/******************************************************************************
+ * SECTION: newfs_volume.c
+ *******************************************************************************/
+int newfs_vol_open(struct custom_options options);
+int newfs_vol_map_write(int64_t offset, int size, int *members, int64_t *member_off, int *len);
+int newfs_vol_fail(int member);
+int newfs_vol_pread(int64_t offset, uint8_t *buf, int size);
+int newfs_vol_pwrite(int64_t offset, uint8_t *buf, int size);
+char *newfs_vol_map_block(int64_t offset, int size, int flags);
+int newfs_vol_discard(int64_t offset, int64_t len);
+int newfs_vol_sync();
+void newfs_vol_close();
+/******************************************************************************
+ * SECTION: newfs_tier.c
+ *******************************************************************************/
+int newfs_tier_open(struct custom_options options);
+int newfs_tier_attach(int64_t pin_len, int64_t grp_len, int64_t grp_pin, int64_t nr_grps, int blk_sz);
+int newfs_tier_pread(int64_t offset, uint8_t *buf, int size);
+int newfs_tier_pwrite(int64_t offset, uint8_t *buf, int size);
+boolean newfs_tier_map_write(int64_t offset, int size, int *len);
+char *newfs_tier_map_block(int64_t offset, int size, int flags);
+int newfs_tier_discard(int64_t offset, int64_t len);
+int newfs_tier_sync();
+void newfs_tier_close();
+/******************************************************************************
+ * SECTION: newfs_parity.c
+ *******************************************************************************/
+void newfs_parity_gen(uint8_t **units, int k, int m, int len);
+int newfs_parity_rebuild(uint8_t **units, int k, int m, int len, const int *missing, int nr_missing);
+/******************************************************************************
+ * SECTION: newfs_bitmap.c
+ *******************************************************************************/
+int64_t newfs_bitmap_alloc(uint8_t *map, int64_t nbits, int64_t *hint);
+int64_t newfs_bitmap_next_run(const uint8_t *map, int64_t nbits, int64_t from, int64_t *len);
+void newfs_bitmap_set_range(uint8_t *map, int64_t start, int64_t len);
+boolean newfs_bitmap_test(const uint8_t *map, int64_t bit);
+void newfs_bitmap_clear(uint8_t *map, int64_t bit);
+int64_t newfs_bitmap_count(const uint8_t *map, int64_t nbits);
+/******************************************************************************
+ * SECTION: newfs_group.c
+ *******************************************************************************/
+int newfs_group_init(boolean is_init);
+struct newfs_group *newfs_group_get(int64_t g);
+int64_t newfs_group_data_blks(int64_t g);
+int64_t newfs_group_find(struct newfs_dentry *dentry);
+int64_t newfs_group_alloc_inode(int64_t g, boolean is_dir);
+void newfs_group_free_inode(int64_t ino, boolean is_dir);
+int newfs_group_flush();
+void newfs_group_destroy();
+/******************************************************************************
+ * SECTION: newfs_space.c
+ *******************************************************************************/
+void newfs_space_build();
+int newfs_space_load(int64_t g);
+int64_t newfs_space_alloc(int64_t goal, int64_t want, int64_t *len);
+void newfs_space_free(int64_t dno);
+void newfs_space_destroy();
+/******************************************************************************
+ * SECTION: newfs_pool.c
+ *******************************************************************************/
+uint8_t *newfs_scratch_get(int size);
+void *newfs_slab_alloc(struct newfs_slab *slab);
+void newfs_slab_free(struct newfs_slab *slab, void *obj);
+void newfs_slab_destroy(struct newfs_slab *slab);
+struct newfs_dentry *new_dentry(char *fname, NFS_FILE_TYPE ftype);
 /******************************************************************************
  * SECTION: newfs.c
  *******************************************************************************/
@@ -66,6 +156,8 @@ int newfs_rmdir(const char *);
 int newfs_rename(const char *, const char *);
 int newfs_utimens(const char *, const struct timespec tv[2]);
 int newfs_truncate(const char *, off_t);
+int newfs_fsync(const char *, int, struct fuse_file_info *);
+int newfs_statfs(const char *, struct statvfs *);
 
 int newfs_open(const char *, struct fuse_file_info *);
 int newfs_opendir(const char *, struct fuse_file_info *);
@@ -74,4 +166,12 @@ int newfs_opendir(const char *, struct fuse_file_info *);
  *******************************************************************************/
 void newfs_dump_inode_map();
 void newfs_dump_data_map();
+void newfs_dump_cache_stat();
+void newfs_dump_pool_stat();
+void newfs_dump_sched_stat();
+void newfs_dump_volume_stat();
+void newfs_dump_tier_stat();
+void newfs_dump_space_stat();
+void newfs_dump_dir_locality(struct newfs_dentry *dir);
+void newfs_bench_bitmap();
 #endif /* _newfs_H_ */
\ No newline at end of file
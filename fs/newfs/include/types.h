@@ -12,6 +12,7 @@ typedef int boolean;
 #define UINT8_BITS 8
 
 #define NFS_MAGIC_NUM 0x52415453
+#define NFS_SUPER_VERSION 2 /* 0为32位偏移的旧格式，1为单一位图的旧格式 */
 #define NFS_SUPER_OFS 0
 #define NFS_ROOT_INO 0
 
@@ -36,29 +37,69 @@ typedef int boolean;
 
 #define NFS_FLAG_BUF_DIRTY 0x1
 #define NFS_FLAG_BUF_OCCUPY 0x2
+
+#define NFS_CACHE_DEFAULT_KB 256 /* 默认块缓存预算 */
+
+#define NFS_SCHED_FIFO_EXPIRE 256 /* 请求入队后最多再等待派发的请求数 */
+#define NFS_SCHED_FIFO_BATCH 16   /* 超时插队后按偏移顺序连续派发的请求数 */
+
+#define NFS_SCRATCH_ALIGN 4096   /* 暂存区按页对齐，一个块的读写不会跨到多余的页上 */
+#define NFS_SCRATCH_MIN_SZ 4096  /* 暂存区扩容粒度 */
+#define NFS_SLAB_CHUNK_OBJS 64   /* 对象池每次批量申请的对象数 */
+#define NFS_SPACE_BINS 16        /* 空闲段按长度分级，最高一级收纳其余所有长段 */
+#define NFS_GROUP_BLKS 1024       /* 每个块组的逻辑块数，默认4MiB的设备上有4组 */
+#define NFS_GROUP_MAP_BLKS 2      /* 组首的inode位图与数据位图各一块 */
+#define NFS_GROUP_UNINIT 0x1      /* 组位图从未写过盘，载入时直接置零 */
+
+#define NFS_VOL_MAX_MEMBERS 8     /* 卷的成员设备上限 */
+#define NFS_STRIPE_DEFAULT_KB 64  /* 默认条带单元 */
+#define NFS_VOL_BATCH 32          /* 跨成员请求每批下发的子请求数 */
+#define NFS_RAID_STRIPE 0         /* 条带，容量与带宽随成员数叠加 */
+#define NFS_RAID_MIRROR 1         /* 镜像，每个成员存一份完整副本 */
+#define NFS_RAID_P 5              /* 单校验，P校验轮转分布，容忍一个成员故障 */
+#define NFS_RAID_PQ 6             /* 双校验，P、Q校验轮转分布，容忍两个成员故障 */
+#define NFS_VOL_LABEL_MAGIC 0x4c4f564e /* 冗余卷成员末尾IO单元中的卷标 */
+#define NFS_TIER_MAGIC 0x5249544e /* 快层开头的分层头，亦记入慢层超级块 */
+#define NFS_TIER_HOT 3            /* 热度达到此值的数据块提升到快层 */
+#define NFS_TIER_HEAT_MAX 255
 /******************************************************************************
  * SECTION: Macro Function
  *******************************************************************************/
 #define NFS_LOGIC_SZ() (newfs_super.sz_logic)
 #define NFS_IO_SZ() (newfs_super.sz_io)
 #define NFS_DISK_SZ() (newfs_super.sz_disk)
-#define NFS_DRIVER() (newfs_super.driver_fd)
+#define NFS_MEMBER_FD(i) (newfs_volume.members[(i)].fd)
 
 #define NFS_ROUND_DOWN(value, round) ((value) % (round) == 0 ? (value) : ((value) / (round)) * (round))
 #define NFS_ROUND_UP(value, round) ((value) % (round) == 0 ? (value) : ((value) / (round) + 1) * (round))
 
-#define NFS_BLKS_SZ(blks) ((blks) * NFS_LOGIC_SZ())
+#define NFS_BLKS_SZ(blks) ((int64_t)(blks) * NFS_LOGIC_SZ())
 #define NFS_ASSIGN_FNAME(pnewfs_dentry, _fname) memcpy((pnewfs_dentry)->name, (_fname), strlen((_fname)))
 // data和inode的布局不一样，所以offset计算方式也不同
 // 多个ino可以在同一个块内，一个dno代表一个块
-#define NFS_INO_OFS(ino) (NFS_BLKS_SZ(newfs_super.ino_offset) + (ino) * sizeof(struct newfs_inode_d))
-#define NFS_DATA_OFS(dno) (NFS_BLKS_SZ(newfs_super.data_offset + (dno)))
+// 块组内依次为inode位图、数据位图、inode表、数据块，ino与dno按组连续编号
+#define NFS_INO_GROUP(ino) ((int64_t)(ino) / newfs_super.ino_per_group)
+#define NFS_DATA_GROUP(dno) ((int64_t)(dno) / newfs_super.data_per_group)
+#define NFS_GROUP_OFS(g) (newfs_super.group_offset + (int64_t)(g) * newfs_super.blks_per_group)
+#define NFS_INO_OFS(ino) (NFS_BLKS_SZ(NFS_GROUP_OFS((ino) / newfs_super.ino_per_group) + NFS_GROUP_MAP_BLKS) + \
+                          (int64_t)((ino) % newfs_super.ino_per_group) * sizeof(struct newfs_inode_d))
+#define NFS_DATA_BLK(dno) (NFS_GROUP_OFS((dno) / newfs_super.data_per_group) + newfs_super.group_meta_blks + \
+                           (dno) % newfs_super.data_per_group)
+#define NFS_DATA_OFS(dno) (NFS_BLKS_SZ(NFS_DATA_BLK(dno)))
+#define NFS_IS_META_BLK(blk) ((blk) < newfs_super.group_offset || \
+                              ((blk) - newfs_super.group_offset) % newfs_super.blks_per_group < newfs_super.group_meta_blks)
+#define NFS_GROUP_INO_MAP(grp) ((grp)->map)
+#define NFS_GROUP_DATA_MAP(grp) ((grp)->map + NFS_LOGIC_SZ())
+
+#define NFS_SLAB_INIT(type) {.obj_sz = sizeof(type), .lock = PTHREAD_MUTEX_INITIALIZER}
 
 #define NFS_IS_DIR(pinode) ((pinode)->dentry->ftype == NFS_DIR)
 #define NFS_IS_REG(pinode) ((pinode)->dentry->ftype == NFS_REG_FILE)
 struct newfs_dentry;
 struct newfs_inode;
 struct newfs_super;
+struct newfs_group;
+struct newfs_group_d;
 
 typedef enum newfs_file_type
 {
@@ -68,7 +109,13 @@ typedef enum newfs_file_type
 
 struct custom_options
 {
-    char *device;
+    char *device;   /* 逗号分隔多个镜像时组成卷 */
+    int stripe_kb;  /* 条带单元(KB)，0取默认值 */
+    int raid;       /* NFS_RAID_STRIPE / NFS_RAID_MIRROR / NFS_RAID_P / NFS_RAID_PQ */
+    char *fast;     /* 分层存储的快层镜像，为空则不分层 */
+    int cache_kb; /* 块缓存预算(KB)，0取默认值，<0关闭缓存 */
+    boolean mmap; /* 使用ddriver的MMAP后端 */
+    boolean bench_bitmap; /* 只运行位图分配的微基准，不挂载 */
     boolean show_help;
 };
 
@@ -79,25 +126,25 @@ struct newfs_super
     /* TODO: Define yourself */
 
     boolean is_mounted;
-    int driver_fd;
     int sz_io;
     int sz_logic;
-    int sz_disk;
-    int sz_usage;
-
-    int sb_offset;       // 0
-    int sb_blks;         // 1
-    int ino_map_offset;  // 1
-    int ino_map_blks;    // 1
-    int data_map_offset; // 2
-    int data_map_blks;   // 1
-    int ino_offset;      // 3
-    int ino_blks;        // = (max_file * sizeof(inode_d)) / sz_logic_blk
-    int data_offset;
-    int data_blks;
-
-    uint8_t *map_inode;
-    uint8_t *map_data;
+    int64_t sz_disk;
+    int64_t sz_usage;
+
+    int64_t sb_offset;       // 0
+    int64_t sb_blks;         // 1
+    int64_t gdt_offset;      // 1
+    int64_t gdt_blks;
+    int64_t group_offset;    /* 第0组的起始块 */
+    int64_t nr_groups;
+    int64_t blks_per_group;  /* 末组可能不满 */
+    int64_t group_meta_blks; /* 组内位图与inode表的块数 */
+    int64_t ino_per_group;
+    int64_t data_per_group;
+    int64_t data_blks;       /* 各组数据块之和 */
+
+    struct newfs_group_d *gdt;  /* 组描述符表，挂载时整表读入 */
+    struct newfs_group *groups; /* 各组的位图，按需载入 */
 
     struct newfs_dentry *root_dentry;
 };
@@ -105,14 +152,14 @@ struct newfs_super
 struct newfs_inode
 {
     /* inode编号 */
-    // ino >= 0 && ino < ino_blks
+    // ino >= 0 && ino < nr_groups * ino_per_group
     int ino; /* 在inode位图中的下标 */
     /* 文件的属性 */
     int size;                    /* 文件已占用空间 */
     NFS_FILE_TYPE ftype;         // 文件类型（目录类型、普通文件类型）
     struct newfs_dentry *dentry; /* 指向该inode的dentry */
 
-    int block_pointer[NFS_MAX_SIZE_PER_FILE]; // 数据块指针
+    int64_t block_pointer[NFS_MAX_SIZE_PER_FILE]; // 数据块指针
 
     /* 目录 */
     int dir_cnt;
@@ -133,24 +180,254 @@ struct newfs_dentry
     struct newfs_inode *inode;    /* 指向inode */
 };
 
+/******************************************************************************
+ * SECTION: Block Buffer Cache
+ *******************************************************************************/
+struct newfs_buf
+{
+    int64_t blk;                 /* 缓存的逻辑块号 */
+    int flag;                    /* NFS_FLAG_BUF_DIRTY | NFS_FLAG_BUF_OCCUPY */
+    uint8_t *data;               /* 一个逻辑块大小的数据 */
+    struct newfs_buf *hash_next; /* 哈希桶链 */
+    struct newfs_buf *lru_prev;  /* LRU链，表头为最近使用 */
+    struct newfs_buf *lru_next;
+};
+
+struct newfs_cache
+{
+    int nr_bufs;                /* 缓存块数量，0表示关闭 */
+    struct newfs_buf *bufs;
+    struct newfs_buf **hash;    /* 按逻辑块号散列，桶数 = nr_bufs */
+    struct newfs_buf lru;       /* LRU哨兵 */
+    uint8_t *pool;              /* 所有块数据的连续内存 */
+
+    long hit_cnt;
+    long miss_cnt;
+    long writeback_cnt;
+};
+
+/******************************************************************************
+ * SECTION: I/O Scheduler
+ *******************************************************************************/
+struct newfs_io_req
+{
+    int64_t offset;  /* 按IO单元对齐 */
+    int size;        /* IO单元的整数倍 */
+    uint8_t *buf;    /* 派发完成前须保持有效 */
+    boolean is_meta; /* 超级块、描述符表及组内位图与inode表的请求优先派发 */
+    boolean done;
+    int sorted_idx;  /* 在按偏移排序的索引中的位置 */
+    long expire;     /* 派发时钟超过该值仍未派发则插队派发 */
+};
+
+struct newfs_sched
+{
+    struct newfs_io_req *reqs; /* 按提交顺序存放 */
+    int *idx;                  /* 派发时按偏移排序的索引 */
+    int nr_reqs;
+    int cap;
+    int64_t head;              /* 磁头当前位置（字节偏移） */
+    long seq;                  /* 派发时钟，每派发一个请求加一 */
+
+    struct ddriver_req aio[DDRIVER_QUEUE_DEPTH];        /* 异步下发的设备请求 */
+    struct ddriver_req *aio_free[DDRIVER_QUEUE_DEPTH];  /* 空闲的设备请求 */
+    int nr_aio_free;
+    int nr_inflight;
+    int member_inflight[NFS_VOL_MAX_MEMBERS];           /* 各成员的在途请求数 */
+    uint8_t *gather;           /* 合并请求的拼接区，一次派发内不复用 */
+    int gather_off;
+    int64_t *discard;          /* 已释放、待丢弃的数据块号 */
+    int nr_discard;
+    int discard_cap;
+
+    long dispatch_cnt;         /* 实际下发到设备的请求数 */
+    long merge_cnt;            /* 被合并掉的请求数 */
+    long expire_cnt;           /* 因超时被提前派发的次数 */
+    long max_inflight;         /* 设备队列的最大深度 */
+    long discard_cnt;          /* 下发到设备的丢弃请求数 */
+    long discard_blks;         /* 丢弃的数据块数 */
+};
+
+/******************************************************************************
+ * SECTION: Striped Volume
+ *******************************************************************************/
+struct newfs_member
+{
+    char *path;
+    int fd;          /* 同步读写与调度器的异步队列 */
+    int aio_fd;      /* 跨成员的请求拆分后经此并行下发 */
+    int64_t size;    /* 设备容量 */
+    boolean failed;  /* 出错后不再访问，卷降级运行 */
+};
+
+struct newfs_volume
+{
+    int level;                /* NFS_RAID_STRIPE / NFS_RAID_MIRROR / NFS_RAID_P / NFS_RAID_PQ */
+    int nr_members;
+    int nr_parity;            /* 校验卷每行的校验单元数，其余卷为0 */
+    int stripe_sz;            /* 条带单元(字节)，IO单元的整数倍；镜像卷按此切分大读 */
+    int sz_io;                /* 各成员须一致 */
+    int64_t member_sz;        /* 每个成员参与条带的容量，冗余卷的卷标紧随其后 */
+    int64_t events;           /* 冗余卷当前的事件计数 */
+    int64_t size;             /* 条带卷为nr_members * member_sz，镜像卷为member_sz，
+                                 校验卷为(nr_members - nr_parity) * member_sz */
+    struct newfs_member members[NFS_VOL_MAX_MEMBERS];
+    pthread_mutex_t lock;     /* 保护各成员aio_fd上的异步队列 */
+    int rr;                   /* 镜像读的轮转起点，定位代价相同时各成员轮流承担 */
+    uint8_t *row_buf;         /* 校验卷的一行暂存，其后为整行批量写的校验单元，受lock保护 */
+
+    long split_cnt;           /* 跨条带单元被拆分的请求数 */
+    long chunk_cnt;           /* 拆分出的子请求数 */
+    long retry_cnt;           /* 读失败后改读其他成员或由校验重建的次数 */
+    long full_cnt;            /* 校验卷无需读取、直接整行写入的行数 */
+    long rmw_cnt;             /* 校验卷先读后写的部分行数 */
+    long recon_cnt;           /* 校验卷由校验重建缺失单元的次数 */
+};
+
+struct newfs_vol_label
+{
+    uint32_t magic;  /* NFS_VOL_LABEL_MAGIC */
+    int32_t level;
+    int64_t events;  /* 挂载及成员故障时递增，落后于其他成员即为过期副本 */
+};
+
+/******************************************************************************
+ * SECTION: Tiered Storage
+ *******************************************************************************/
+struct newfs_tier_hdr
+{
+    uint32_t magic;    /* NFS_TIER_MAGIC */
+    int32_t blk_sz;    /* 迁移粒度，即逻辑块 */
+    int64_t pin_len;   /* 卷开头固定在快层的元数据字节数 */
+    int64_t grp_len;   /* 之后每组的字节数 */
+    int64_t grp_pin;   /* 每组开头固定在快层的位图与inode表字节数 */
+    int64_t nr_grps;
+    int64_t nr_slots;
+    int64_t vol_size;  /* 慢层卷的容量，换了慢层即失配 */
+};
+
+struct newfs_tier
+{
+    char *path;
+    int fd;                   /* 快层设备，-1表示不分层 */
+    int64_t size;             /* 快层容量 */
+    int blk_sz;               /* 为0时尚未建立分层，读写全部落在慢层 */
+    int64_t pin_len;          /* 超级块与组描述符表，其后各组的元数据依次固定在快层 */
+    int64_t grp_len;
+    int64_t grp_pin;
+    int64_t nr_grps;
+    int64_t map_off;          /* 槽位表在快层的偏移，每个槽位一个int64_t块号 */
+    int64_t slot_off;         /* 首个槽位在快层的偏移 */
+    int nr_slots;
+    int64_t nr_blks;          /* 慢层卷的块数 */
+    int64_t *slot_blk;        /* 各槽位缓存的块号，-1为空闲 */
+    boolean *slot_dirty;      /* 槽位比慢层新，淘汰时须写回 */
+    int *blk_slot;            /* 各块所在的槽位，-1表示在慢层 */
+    uint8_t *heat;            /* 各块的访问热度，定期减半 */
+    int64_t touches;          /* 距上次衰减的访问次数 */
+    int hand;                 /* 淘汰槽位的时钟指针 */
+    uint8_t *blk_buf;         /* 迁移时的一块暂存 */
+    pthread_mutex_t lock;
+
+    long pin_cnt;             /* 落在固定元数据上的访问 */
+    long fast_cnt;            /* 命中快层槽位的访问 */
+    long slow_cnt;            /* 落在慢层的访问 */
+    long promote_cnt;
+    long demote_cnt;
+    long writeback_cnt;       /* 淘汰脏槽位时写回慢层的次数 */
+};
+
+/******************************************************************************
+ * SECTION: Memory Pool
+ *******************************************************************************/
+struct newfs_scratch
+{
+    uint8_t *buf; /* NFS_SCRATCH_ALIGN对齐 */
+    int size;
+};
+
+struct newfs_slab
+{
+    int obj_sz;
+    void *free_list; /* 空闲对象链，链接指针存放在对象头部 */
+    void *chunks;    /* 已申请的chunk链 */
+    pthread_mutex_t lock;
+
+    long alloc_cnt;  /* 对象分配次数 */
+    long malloc_cnt; /* 实际调用malloc次数 */
+};
+
+struct newfs_pool_stat
+{
+    long scratch_hit_cnt;  /* 暂存区复用次数，即省掉的malloc/free */
+    long scratch_grow_cnt; /* 暂存区扩容次数 */
+};
+
+/******************************************************************************
+ * SECTION: Block Group
+ *******************************************************************************/
+struct newfs_group
+{
+    uint8_t *map;   /* inode位图与数据位图相邻的两块，NULL表示未载入 */
+    boolean dirty;  /* 位图比盘上新，卸载时写回 */
+    int64_t ino_hint; /* 组内下次分配inode时从此号起找 */
+};
+
+/******************************************************************************
+ * SECTION: Free Space Index
+ *******************************************************************************/
+struct newfs_free_ext
+{
+    int64_t start;                  /* 空闲段的起始数据块号 */
+    int64_t len;
+    struct newfs_free_ext *bin_prev; /* 同一长度级别的双向链 */
+    struct newfs_free_ext *bin_next;
+};
+
+struct newfs_space
+{
+    struct newfs_free_ext **exts;   /* 已载入各组的空闲段，按起点升序，二分查找相邻段 */
+    int nr_exts;
+    int cap;
+    struct newfs_free_ext *bins[NFS_SPACE_BINS]; /* 第k级存放长度在[2^k, 2^(k+1))的段 */
+
+    int64_t free_blks;              /* 空闲数据块数，即各组描述符之和 */
+    int64_t free_inos;              /* 空闲inode数，即各组描述符之和 */
+};
+
 /******************************************************************************
  * SECTION: FS Specific Structure - Disk structure
  *******************************************************************************/
 struct newfs_super_d
 {
     uint32_t magic_num;
-    int sz_usage;
+    uint32_t version;        // 旧格式此处为恒为0的sz_usage
+    int64_t sz_usage;
 
-    int sb_offset;       // 0
-    int sb_blks;         // 1
-    int ino_map_offset;  // 1
-    int ino_map_blks;    // 1
-    int data_map_offset; // 2
-    int data_map_blks;   // 1
-    int ino_offset;      // 3
-    int ino_blks;        // = (max_file * sizeof(inode_d)) / sz_logic_blk
-    int data_offset;
-    int data_blks;
+    int64_t sb_offset;       // 0
+    int64_t sb_blks;         // 1
+    int64_t gdt_offset;      // 1
+    int64_t gdt_blks;
+    int64_t group_offset;
+    int64_t nr_groups;
+    int64_t blks_per_group;
+    int64_t group_meta_blks;
+    int64_t ino_per_group;
+    int64_t data_per_group;
+    int64_t data_blks;
+
+    int32_t nr_members;      // 卷的成员数，旧镜像此处为0即单设备
+    int32_t stripe_sz;
+    int32_t raid_level;      // 旧镜像此处为0即条带
+    uint32_t tier_magic;     // 元数据固定在快层时为NFS_TIER_MAGIC，须带快层挂载
+};
+
+struct newfs_group_d
+{
+    int32_t free_blks;
+    int32_t free_inos;
+    int32_t nr_dirs;
+    uint32_t flags;          // NFS_GROUP_UNINIT
 };
 
 struct newfs_inode_d
@@ -161,7 +438,7 @@ struct newfs_inode_d
     int size;            /* 文件已占用空间 */
     NFS_FILE_TYPE ftype; // 文件类型（目录类型、普通文件类型）
 
-    int block_pointer[NFS_MAX_SIZE_PER_FILE]; // 数据块指针（可固定分配）
+    int64_t block_pointer[NFS_MAX_SIZE_PER_FILE]; // 数据块指针（可固定分配）
     int dir_cnt;
 };
 
@@ -176,16 +453,4 @@ struct newfs_dentry_d
 
 #define DENTRY_PER_BLK (NFS_LOGIC_SZ() / sizeof(struct newfs_dentry_d))
 
-// ####################### Functions #######################
-static inline struct newfs_dentry *new_dentry(char *fname, NFS_FILE_TYPE ftype)
-{
-    struct newfs_dentry *dentry = (struct newfs_dentry *)malloc(sizeof(struct newfs_dentry));
-    memset(dentry, 0, sizeof(struct newfs_dentry));
-    NFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype = ftype;
-    dentry->ino = -1;
-    dentry->inode = NULL;
-    dentry->parent = NULL;
-    dentry->brother = NULL;
-}
 #endif /* _TYPES_H_ */
\ No newline at end of file
@@ -18,11 +18,23 @@
  *******************************************************************************/
 struct newfs_super newfs_super;
 struct custom_options newfs_options;
+extern struct newfs_slab newfs_dentry_slab;
+struct newfs_cache newfs_cache;
+struct newfs_sched newfs_sched;
+struct newfs_volume newfs_volume = {.lock = PTHREAD_MUTEX_INITIALIZER};
+struct newfs_tier newfs_tier = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER};
+struct newfs_space newfs_space;
 /******************************************************************************
  * SECTION: 全局变量
  *******************************************************************************/
 static const struct fuse_opt option_spec[] = {
 	OPTION("--device=%s", device),
+	OPTION("--stripe_kb=%d", stripe_kb),
+	OPTION("--raid=%d", raid),
+	OPTION("--fast=%s", fast),
+	OPTION("--cache_kb=%d", cache_kb),
+	OPTION("--mmap", mmap),
+	OPTION("--bench_bitmap", bench_bitmap),
 	OPTION("-h", show_help),
 	OPTION("--help", show_help),
 	FUSE_OPT_END};
@@ -46,6 +58,8 @@ static struct fuse_operations operations = {
 	.unlink = newfs_unlink,		/* 删除文件 */
 	.rmdir = newfs_rmdir,		/* 删除目录， rm -r */
 	.rename = newfs_rename,		/* 重命名，mv */
+	.fsync = newfs_fsync,		/* 刷回文件及块缓存 */
+	.statfs = newfs_statfs,		/* 容量统计，df */
 
 	.open = newfs_open,
 	.opendir = newfs_opendir,
@@ -103,6 +117,7 @@ int newfs_mkdir(const char *path, mode_t mode)
 	struct newfs_dentry *last_dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_dentry *dentry;
 	struct newfs_inode *inode;
+	int ret;
 
 	if (is_find)
 	{
@@ -118,7 +133,18 @@ int newfs_mkdir(const char *path, mode_t mode)
 	dentry = new_dentry(fname, NFS_DIR);
 	dentry->parent = last_dentry;
 	inode = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (inode == NULL)
+	{
+		newfs_slab_free(&newfs_dentry_slab, dentry);
+		return -NFS_ERROR_NOSPACE;
+	}
+	ret = newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (ret < 0)
+	{ /* 父目录放不下，退还刚分配的inode */
+		newfs_drop_inode(inode);
+		newfs_slab_free(&newfs_dentry_slab, dentry);
+		return ret;
+	}
 
 	return NFS_ERROR_NONE;
 }
@@ -225,6 +251,7 @@ int newfs_mknod(const char *path, mode_t mode, dev_t dev)
 	struct newfs_dentry *dentry;
 	struct newfs_inode *inode;
 	char *fname;
+	int ret;
 
 	if (is_find == TRUE)
 	{ // 已有此文件
@@ -243,7 +270,18 @@ int newfs_mknod(const char *path, mode_t mode, dev_t dev)
 	}
 	dentry->parent = last_dentry;
 	inode = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (inode == NULL)
+	{
+		newfs_slab_free(&newfs_dentry_slab, dentry);
+		return -NFS_ERROR_NOSPACE;
+	}
+	ret = newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (ret < 0)
+	{ /* 父目录放不下，退还刚分配的inode */
+		newfs_drop_inode(inode);
+		newfs_slab_free(&newfs_dentry_slab, dentry);
+		return ret;
+	}
 	return NFS_ERROR_NONE;
 }
 
@@ -298,7 +336,10 @@ int newfs_write(const char *path, const char *buf, size_t size, off_t offset,
 		return -NFS_ERROR_SEEK;
 	}
 
-	newfs_write_file(inode, buf, size, offset);
+	if (newfs_write_file(inode, buf, size, offset) != NFS_ERROR_NONE)
+	{
+		return -NFS_ERROR_NOSPACE;
+	}
 
 	return size;
 }
@@ -364,6 +405,8 @@ int newfs_unlink(const char *path)
 
 	newfs_drop_inode(inode);
 	newfs_drop_dentry(dentry->parent->inode, dentry);
+	/* 释放的块被重新分配前丢弃 */
+	newfs_sched_discard();
 	return NFS_ERROR_NONE;
 }
 
@@ -429,6 +472,7 @@ int newfs_rename(const char *from, const char *to)
 
 	to_dentry = newfs_lookup(to, &is_find, &is_root);
 	newfs_drop_inode(to_dentry->inode); /* 保证生成的inode被释放 */
+	newfs_sched_discard();
 	to_dentry->ino = from_inode->ino;	/* 指向新的inode */
 	to_dentry->inode = from_inode;
 
@@ -494,6 +538,53 @@ int newfs_truncate(const char *path, off_t offset)
 	return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 同步文件，将inode刷回块缓存后写回所有脏块
+ *
+ * @param path 相对于挂载点的路径
+ * @param datasync 可忽略
+ * @param fi 可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	boolean is_find, is_root;
+	struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (is_find == FALSE)
+	{
+		return -NFS_ERROR_NOTFOUND;
+	}
+
+	if (newfs_sync_inode(dentry->inode) != NFS_ERROR_NONE)
+	{
+		return -NFS_ERROR_IO;
+	}
+	return newfs_driver_sync();
+}
+
+/**
+ * @brief 文件系统容量统计，直接取空闲空间索引维护的计数
+ *
+ * @param path 可忽略
+ * @param newfs_statvfs
+ * @return int 0成功，否则失败
+ */
+int newfs_statfs(const char *path, struct statvfs *newfs_statvfs)
+{
+	memset(newfs_statvfs, 0, sizeof(struct statvfs));
+	newfs_statvfs->f_bsize = NFS_LOGIC_SZ();
+	newfs_statvfs->f_frsize = NFS_LOGIC_SZ();
+	newfs_statvfs->f_blocks = newfs_super.data_blks;
+	newfs_statvfs->f_bfree = newfs_space.free_blks;
+	newfs_statvfs->f_bavail = newfs_space.free_blks;
+	newfs_statvfs->f_files = newfs_super.ino_per_group * newfs_super.nr_groups;
+	newfs_statvfs->f_ffree = newfs_space.free_inos;
+	newfs_statvfs->f_favail = newfs_space.free_inos;
+	newfs_statvfs->f_namemax = NFS_MAX_FILE_NAME;
+	return NFS_ERROR_NONE;
+}
+
 /**
  * @brief 访问文件，因为读写文件时需要查看权限
  *
@@ -550,6 +641,13 @@ int main(int argc, char **argv)
 	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -NFS_ERROR_INVAL;
 
+	if (newfs_options.bench_bitmap)
+	{
+		newfs_bench_bitmap();
+		fuse_opt_free_args(&args);
+		return 0;
+	}
+
 	ret = fuse_main(args.argc, args.argv, &operations, NULL);
 	fuse_opt_free_args(&args);
 	return ret;
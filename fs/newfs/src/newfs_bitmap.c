@@ -0,0 +1,246 @@
+#include "newfs.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+ * SECTION: 内部函数
+ *******************************************************************************/
+#define BM_WORD_BITS 64
+#define BM_SKIP_WORDS 4 /* 一次跳过256位全满的区域 */
+
+/**
+ * @brief 取位图的第w个64位字，位i在第i/8字节的第i%8位，与盘上的按字节布局一致
+ *
+ * @param map
+ * @param w
+ * @return uint64_t
+ */
+static inline uint64_t bm_load(const uint8_t *map, int64_t w)
+{
+    uint64_t v;
+
+    memcpy(&v, map + w * sizeof(uint64_t), sizeof(uint64_t));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/**
+ * @brief 从第w个字起跳过连续全满的字，每次看BM_SKIP_WORDS个
+ *
+ * @param map
+ * @param w
+ * @param last 字数上限
+ * @return int64_t 第一个可能含空闲位的字
+ */
+static int64_t bm_skip_full(const uint8_t *map, int64_t w, int64_t last)
+{
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi32(-1);
+
+    while (w + BM_SKIP_WORDS <= last &&
+           _mm256_testc_si256(_mm256_loadu_si256((const __m256i *)(map + w * sizeof(uint64_t))), ones))
+    {
+        w += BM_SKIP_WORDS;
+    }
+#else
+    while (w + BM_SKIP_WORDS <= last &&
+           (bm_load(map, w) & bm_load(map, w + 1) & bm_load(map, w + 2) & bm_load(map, w + 3)) == ~0ULL)
+    {
+        w += BM_SKIP_WORDS;
+    }
+#endif
+    return w;
+}
+
+/**
+ * @brief 在[start, end)中找第一个空闲位
+ *
+ * @param map
+ * @param start
+ * @param end
+ * @return int64_t 没有时返回-1
+ */
+static int64_t bm_find_zero(const uint8_t *map, int64_t start, int64_t end)
+{
+    int64_t last = (end + BM_WORD_BITS - 1) / BM_WORD_BITS;
+    int64_t w = start / BM_WORD_BITS;
+    int64_t bit;
+    uint64_t v;
+
+    if (start >= end)
+    {
+        return -1;
+    }
+    /* 首字中start之前的位视作已占用 */
+    v = ~bm_load(map, w) & (~0ULL << (start % BM_WORD_BITS));
+    while (v == 0)
+    {
+        w = bm_skip_full(map, w + 1, last);
+        if (w >= last)
+        {
+            return -1;
+        }
+        v = ~bm_load(map, w);
+    }
+    bit = w * BM_WORD_BITS + __builtin_ctzll(v);
+    return bit < end ? bit : -1;
+}
+
+/**
+ * @brief 在[start, end)中找第一个已占用位
+ *
+ * @param map
+ * @param start
+ * @param end
+ * @return int64_t 没有时返回end
+ */
+static int64_t bm_find_one(const uint8_t *map, int64_t start, int64_t end)
+{
+    int64_t last = (end + BM_WORD_BITS - 1) / BM_WORD_BITS;
+    int64_t w = start / BM_WORD_BITS;
+    int64_t bit;
+    uint64_t v;
+
+    if (start >= end)
+    {
+        return end;
+    }
+    v = bm_load(map, w) & (~0ULL << (start % BM_WORD_BITS));
+    while (v == 0)
+    {
+        if (++w >= last)
+        {
+            return end;
+        }
+        v = bm_load(map, w);
+    }
+    bit = w * BM_WORD_BITS + __builtin_ctzll(v);
+    return bit < end ? bit : end;
+}
+
+/******************************************************************************
+ * SECTION: 位图接口
+ *******************************************************************************/
+/**
+ * @brief 按next-fit分配一位：从游标处向后找，到末尾后绕回开头，
+ * 连续创建文件时不再每次从头扫过已分配的部分
+ *
+ * @param map 长度为8字节的整数倍
+ * @param nbits 有效位数
+ * @param hint 游标，返回时指向分配位的下一位
+ * @return int64_t 分配的位，位图已满时返回-1
+ */
+int64_t newfs_bitmap_alloc(uint8_t *map, int64_t nbits, int64_t *hint)
+{
+    int64_t start = *hint < nbits && *hint > 0 ? *hint : 0;
+    int64_t bit;
+
+    bit = bm_find_zero(map, start, nbits);
+    if (bit < 0)
+    {
+        bit = bm_find_zero(map, 0, start);
+    }
+    if (bit < 0)
+    {
+        return -1;
+    }
+    map[bit / UINT8_BITS] |= (uint8_t)(0x1 << (bit % UINT8_BITS));
+    *hint = bit + 1;
+    return bit;
+}
+
+/**
+ * @brief 找from之后的下一段连续空闲位，用于挂载时建立空闲段索引
+ *
+ * @param map 长度为8字节的整数倍
+ * @param nbits 有效位数
+ * @param from 起始位
+ * @param len 返回空闲段的长度
+ * @return int64_t 空闲段的起点，没有时返回-1
+ */
+int64_t newfs_bitmap_next_run(const uint8_t *map, int64_t nbits, int64_t from, int64_t *len)
+{
+    int64_t start = bm_find_zero(map, from, nbits);
+
+    if (start < 0)
+    {
+        return -1;
+    }
+    *len = bm_find_one(map, start, nbits) - start;
+    return start;
+}
+
+/**
+ * @brief 占用[start, start + len)
+ *
+ * @param map
+ * @param start
+ * @param len
+ */
+void newfs_bitmap_set_range(uint8_t *map, int64_t start, int64_t len)
+{
+    int64_t bit;
+
+    for (bit = start; bit < start + len && bit % UINT8_BITS != 0; bit++)
+    {
+        map[bit / UINT8_BITS] |= (uint8_t)(0x1 << (bit % UINT8_BITS));
+    }
+    for (; bit + UINT8_BITS <= start + len; bit += UINT8_BITS)
+    {
+        map[bit / UINT8_BITS] = 0xff;
+    }
+    for (; bit < start + len; bit++)
+    {
+        map[bit / UINT8_BITS] |= (uint8_t)(0x1 << (bit % UINT8_BITS));
+    }
+}
+
+/**
+ * @brief 判断一位是否已占用
+ *
+ * @param map
+ * @param bit
+ * @return boolean
+ */
+boolean newfs_bitmap_test(const uint8_t *map, int64_t bit)
+{
+    return (map[bit / UINT8_BITS] >> (bit % UINT8_BITS)) & 0x1;
+}
+
+/**
+ * @brief 按下标直接清除一位
+ *
+ * @param map
+ * @param bit
+ */
+void newfs_bitmap_clear(uint8_t *map, int64_t bit)
+{
+    map[bit / UINT8_BITS] &= (uint8_t)(~(0x1 << (bit % UINT8_BITS)));
+}
+
+/**
+ * @brief 统计前nbits位中已占用的位数
+ *
+ * @param map 长度为8字节的整数倍
+ * @param nbits
+ * @return int64_t
+ */
+int64_t newfs_bitmap_count(const uint8_t *map, int64_t nbits)
+{
+    int64_t cnt = 0;
+    int64_t w;
+
+    for (w = 0; w < nbits / BM_WORD_BITS; w++)
+    {
+        cnt += __builtin_popcountll(bm_load(map, w));
+    }
+    if (nbits % BM_WORD_BITS != 0)
+    {
+        cnt += __builtin_popcountll(bm_load(map, w) & ((1ULL << (nbits % BM_WORD_BITS)) - 1));
+    }
+    return cnt;
+}
@@ -0,0 +1,336 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super;
+extern struct newfs_cache newfs_cache;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************
+ * SECTION: 内部函数
+ *******************************************************************************/
+#define NFS_CACHE_HASH(blk) ((blk) % newfs_cache.nr_bufs)
+
+static void lru_unlink(struct newfs_buf *buf)
+{
+    buf->lru_prev->lru_next = buf->lru_next;
+    buf->lru_next->lru_prev = buf->lru_prev;
+}
+
+static void lru_push_head(struct newfs_buf *buf)
+{
+    buf->lru_next = newfs_cache.lru.lru_next;
+    buf->lru_prev = &newfs_cache.lru;
+    newfs_cache.lru.lru_next->lru_prev = buf;
+    newfs_cache.lru.lru_next = buf;
+}
+
+static void lru_push_tail(struct newfs_buf *buf)
+{
+    buf->lru_prev = newfs_cache.lru.lru_prev;
+    buf->lru_next = &newfs_cache.lru;
+    newfs_cache.lru.lru_prev->lru_next = buf;
+    newfs_cache.lru.lru_prev = buf;
+}
+
+static void hash_insert(struct newfs_buf *buf)
+{
+    int bucket = NFS_CACHE_HASH(buf->blk);
+    buf->hash_next = newfs_cache.hash[bucket];
+    newfs_cache.hash[bucket] = buf;
+}
+
+static void hash_remove(struct newfs_buf *buf)
+{
+    struct newfs_buf **cursor = &newfs_cache.hash[NFS_CACHE_HASH(buf->blk)];
+    while (*cursor)
+    {
+        if (*cursor == buf)
+        {
+            *cursor = buf->hash_next;
+            break;
+        }
+        cursor = &(*cursor)->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+static struct newfs_buf *hash_find(int64_t blk)
+{
+    struct newfs_buf *buf = newfs_cache.hash[NFS_CACHE_HASH(blk)];
+    while (buf)
+    {
+        if (buf->blk == blk)
+        {
+            return buf;
+        }
+        buf = buf->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 将脏块写回设备
+ *
+ * @param buf
+ * @return int
+ */
+static int buf_writeback(struct newfs_buf *buf)
+{
+    if ((buf->flag & NFS_FLAG_BUF_DIRTY) == 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+    if (newfs_dev_write(NFS_BLKS_SZ(buf->blk), buf->data, NFS_LOGIC_SZ()) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    buf->flag &= ~NFS_FLAG_BUF_DIRTY;
+    newfs_cache.writeback_cnt++;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 获取逻辑块对应的缓存块，未命中时淘汰LRU尾部块
+ *
+ * @param blk 逻辑块号
+ * @param load 未命中时是否从设备读入
+ * @return struct newfs_buf* 失败返回NULL
+ */
+static struct newfs_buf *buf_get(int64_t blk, boolean load)
+{
+    struct newfs_buf *buf = hash_find(blk);
+
+    if (buf != NULL)
+    {
+        newfs_cache.hit_cnt++;
+        lru_unlink(buf);
+        lru_push_head(buf);
+        return buf;
+    }
+
+    newfs_cache.miss_cnt++;
+    buf = newfs_cache.lru.lru_prev;
+    if (buf->flag & NFS_FLAG_BUF_OCCUPY)
+    {
+        if (buf_writeback(buf) != NFS_ERROR_NONE)
+        {
+            return NULL;
+        }
+        hash_remove(buf);
+        buf->flag = 0;
+    }
+
+    if (load && newfs_dev_read(NFS_BLKS_SZ(blk), buf->data, NFS_LOGIC_SZ()) != NFS_ERROR_NONE)
+    {
+        return NULL;
+    }
+    buf->blk = blk;
+    buf->flag = NFS_FLAG_BUF_OCCUPY;
+    hash_insert(buf);
+    lru_unlink(buf);
+    lru_push_head(buf);
+    return buf;
+}
+
+/******************************************************************************
+ * SECTION: 块缓存接口
+ *******************************************************************************/
+/**
+ * @brief 按预算初始化块缓存，需在sz_logic确定后调用
+ *
+ * @param cache_kb 缓存预算(KB)，0取默认值，<0关闭缓存
+ * @return int
+ */
+int newfs_cache_init(int cache_kb)
+{
+    int i;
+
+    memset(&newfs_cache, 0, sizeof(struct newfs_cache));
+    if (cache_kb < 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+    if (cache_kb == 0)
+    {
+        cache_kb = NFS_CACHE_DEFAULT_KB;
+    }
+
+    newfs_cache.nr_bufs = cache_kb * 1024 / NFS_LOGIC_SZ();
+    if (newfs_cache.nr_bufs == 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+    newfs_cache.bufs = (struct newfs_buf *)calloc(newfs_cache.nr_bufs, sizeof(struct newfs_buf));
+    newfs_cache.hash = (struct newfs_buf **)calloc(newfs_cache.nr_bufs, sizeof(struct newfs_buf *));
+    newfs_cache.pool = (uint8_t *)malloc(NFS_BLKS_SZ(newfs_cache.nr_bufs));
+    if (!newfs_cache.bufs || !newfs_cache.hash || !newfs_cache.pool)
+    {
+        newfs_cache_destroy();
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    newfs_cache.lru.lru_next = &newfs_cache.lru;
+    newfs_cache.lru.lru_prev = &newfs_cache.lru;
+    for (i = 0; i < newfs_cache.nr_bufs; i++)
+    {
+        newfs_cache.bufs[i].blk = -1;
+        newfs_cache.bufs[i].data = newfs_cache.pool + NFS_BLKS_SZ(i);
+        lru_push_head(&newfs_cache.bufs[i]);
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 经由缓存读取任意字节区间
+ *
+ * @param offset
+ * @param out_content
+ * @param size
+ * @return int
+ */
+int newfs_cache_read(int64_t offset, uint8_t *out_content, int size)
+{
+    struct newfs_buf *buf;
+    int64_t blk = offset / NFS_LOGIC_SZ();
+    int bias = offset % NFS_LOGIC_SZ();
+    int len;
+
+    pthread_mutex_lock(&cache_lock);
+    while (size > 0)
+    {
+        buf = buf_get(blk, TRUE);
+        if (buf == NULL)
+        {
+            pthread_mutex_unlock(&cache_lock);
+            return -NFS_ERROR_IO;
+        }
+        len = NFS_LOGIC_SZ() - bias < size ? NFS_LOGIC_SZ() - bias : size;
+        memcpy(out_content, buf->data + bias, len);
+        out_content += len;
+        size -= len;
+        bias = 0;
+        blk++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 经由缓存写入任意字节区间，块被标记为脏，延迟写回
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int newfs_cache_write(int64_t offset, uint8_t *in_content, int size)
+{
+    struct newfs_buf *buf;
+    int64_t blk = offset / NFS_LOGIC_SZ();
+    int bias = offset % NFS_LOGIC_SZ();
+    int len;
+
+    pthread_mutex_lock(&cache_lock);
+    while (size > 0)
+    {
+        len = NFS_LOGIC_SZ() - bias < size ? NFS_LOGIC_SZ() - bias : size;
+        /* 整块覆盖时无需从设备读入旧内容 */
+        buf = buf_get(blk, len != NFS_LOGIC_SZ());
+        if (buf == NULL)
+        {
+            pthread_mutex_unlock(&cache_lock);
+            return -NFS_ERROR_IO;
+        }
+        memcpy(buf->data + bias, in_content, len);
+        buf->flag |= NFS_FLAG_BUF_DIRTY;
+        in_content += len;
+        size -= len;
+        bias = 0;
+        blk++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写回所有脏块
+ *
+ * @return int
+ */
+int newfs_cache_flush()
+{
+    struct newfs_buf *buf;
+    int i;
+    int ret = NFS_ERROR_NONE;
+
+    pthread_mutex_lock(&cache_lock);
+    /* 脏块统一交给调度器排序合并后写回 */
+    for (i = 0; i < newfs_cache.nr_bufs; i++)
+    {
+        buf = &newfs_cache.bufs[i];
+        if ((buf->flag & NFS_FLAG_BUF_DIRTY) &&
+            newfs_sched_submit_write(NFS_BLKS_SZ(buf->blk), buf->data, NFS_LOGIC_SZ()) != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_NOSPACE;
+            break;
+        }
+    }
+    if (newfs_sched_dispatch() != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    if (ret == NFS_ERROR_NONE)
+    {
+        for (i = 0; i < newfs_cache.nr_bufs; i++)
+        {
+            buf = &newfs_cache.bufs[i];
+            if (buf->flag & NFS_FLAG_BUF_DIRTY)
+            {
+                buf->flag &= ~NFS_FLAG_BUF_DIRTY;
+                newfs_cache.writeback_cnt++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return ret;
+}
+
+/**
+ * @brief 丢弃一段逻辑块的缓存而不写回，用于块被释放之后
+ *
+ * @param blk 起始逻辑块号
+ * @param blk_cnt 块数
+ */
+void newfs_cache_invalidate(int64_t blk, int64_t blk_cnt)
+{
+    struct newfs_buf *buf;
+    int64_t i;
+
+    pthread_mutex_lock(&cache_lock);
+    for (i = 0; i < blk_cnt && newfs_cache.nr_bufs > 0; i++)
+    {
+        buf = hash_find(blk + i);
+        if (buf == NULL)
+        {
+            continue;
+        }
+        /* 放到LRU尾部，最先被复用 */
+        hash_remove(buf);
+        buf->flag = 0;
+        buf->blk = -1;
+        lru_unlink(buf);
+        lru_push_tail(buf);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * @brief 释放块缓存，调用前应先newfs_cache_flush
+ */
+void newfs_cache_destroy()
+{
+    free(newfs_cache.bufs);
+    free(newfs_cache.hash);
+    free(newfs_cache.pool);
+    memset(&newfs_cache, 0, sizeof(struct newfs_cache));
+}
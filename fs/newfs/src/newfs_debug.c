@@ -2,71 +2,340 @@
 
 extern struct newfs_super newfs_super;
 extern struct custom_options newfs_options;
+extern struct newfs_cache newfs_cache;
+extern struct newfs_sched newfs_sched;
+extern struct newfs_slab newfs_dentry_slab;
+extern struct newfs_slab newfs_inode_slab;
+extern struct newfs_slab newfs_extent_slab;
+extern struct newfs_pool_stat newfs_pool_stat;
+extern struct newfs_space newfs_space;
+extern struct newfs_volume newfs_volume;
+extern struct newfs_tier newfs_tier;
 
-void newfs_dump_inode_map()
+static void dump_map(const uint8_t *map, int64_t bytes)
 {
     int byte_cursor = 0;
     int bit_cursor = 0;
+    int i;
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.ino_map_blks);
-         byte_cursor += 4)
+    for (byte_cursor = 0; byte_cursor < bytes; byte_cursor += 4)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+        for (i = 0; i < 4; i++)
         {
-            printf("%d ", (newfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) >> bit_cursor);
+            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+            {
+                printf("%d ", (map[byte_cursor + i] & (0x1 << bit_cursor)) >> bit_cursor);
+            }
+            printf(i < 3 ? "\t" : "\n");
         }
-        printf("\t");
+    }
+}
+
+void newfs_dump_inode_map()
+{
+    int64_t g;
 
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+    for (g = 0; g < newfs_super.nr_groups; g++)
+    {
+        if (newfs_super.groups[g].map != NULL)
         {
-            printf("%d ", (newfs_super.map_inode[byte_cursor + 1] & (0x1 << bit_cursor)) >> bit_cursor);
+            printf("group %ld:\n", (long)g);
+            dump_map(NFS_GROUP_INO_MAP(&newfs_super.groups[g]),
+                     NFS_ROUND_UP(newfs_super.ino_per_group, UINT32_BITS) / UINT8_BITS);
         }
-        printf("\t");
+    }
+}
+
+void newfs_dump_data_map()
+{
+    int64_t g;
 
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+    for (g = 0; g < newfs_super.nr_groups; g++)
+    {
+        if (newfs_super.groups[g].map != NULL)
         {
-            printf("%d ", (newfs_super.map_inode[byte_cursor + 2] & (0x1 << bit_cursor)) >> bit_cursor);
+            printf("group %ld:\n", (long)g);
+            dump_map(NFS_GROUP_DATA_MAP(&newfs_super.groups[g]),
+                     NFS_ROUND_UP(newfs_group_data_blks(g), UINT32_BITS) / UINT8_BITS);
         }
-        printf("\t");
+    }
+}
+
+void newfs_dump_cache_stat()
+{
+    printf("cache bufs: %d, hit: %ld, miss: %ld, writeback: %ld\n",
+           newfs_cache.nr_bufs, newfs_cache.hit_cnt,
+           newfs_cache.miss_cnt, newfs_cache.writeback_cnt);
+}
+
+void newfs_dump_pool_stat()
+{
+    printf("scratch reuse: %ld, grow: %ld\n",
+           newfs_pool_stat.scratch_hit_cnt, newfs_pool_stat.scratch_grow_cnt);
+    printf("dentry slab alloc: %ld, malloc avoided: %ld\n", newfs_dentry_slab.alloc_cnt,
+           newfs_dentry_slab.alloc_cnt - newfs_dentry_slab.malloc_cnt);
+    printf("inode slab alloc: %ld, malloc avoided: %ld\n", newfs_inode_slab.alloc_cnt,
+           newfs_inode_slab.alloc_cnt - newfs_inode_slab.malloc_cnt);
+    printf("extent slab alloc: %ld, malloc avoided: %ld\n", newfs_extent_slab.alloc_cnt,
+           newfs_extent_slab.alloc_cnt - newfs_extent_slab.malloc_cnt);
+}
+
+void newfs_dump_sched_stat()
+{
+    struct ddriver_stats stats;
+    uint64_t cmd_cnt = 0, depth_sum = 0, depth_max = 0, reorder_cnt = 0, saved_ns = 0;
+    int i;
 
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+    printf("sched dispatch: %ld, merged: %ld, expired: %ld, max inflight: %ld\n",
+           newfs_sched.dispatch_cnt, newfs_sched.merge_cnt, newfs_sched.expire_cnt,
+           newfs_sched.max_inflight);
+    printf("discard requests: %ld, blocks: %ld\n",
+           newfs_sched.discard_cnt, newfs_sched.discard_blks);
+    /* 设备侧命令队列的重排，用于对比调度器在其之上的收益 */
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        if (!newfs_volume.members[i].failed && ddriver_ioctl(NFS_MEMBER_FD(i), IOC_REQ_DEVICE_STATS, &stats) == 0)
         {
-            printf("%d ", (newfs_super.map_inode[byte_cursor + 3] & (0x1 << bit_cursor)) >> bit_cursor);
+            cmd_cnt += stats.ncq_cmd_cnt;
+            depth_sum += stats.ncq_depth_sum;
+            depth_max = stats.ncq_depth_max > depth_max ? stats.ncq_depth_max : depth_max;
+            reorder_cnt += stats.ncq_reorder_cnt;
+            saved_ns += stats.ncq_saved_ns;
         }
-        printf("\n");
+    }
+    if (cmd_cnt > 0)
+    {
+        printf("device ncq dispatch: %lu, avg depth: %.2f, max depth: %lu, reordered: %lu, saved: %luus\n",
+               cmd_cnt, (double)depth_sum / cmd_cnt, depth_max, reorder_cnt, saved_ns / 1000);
     }
 }
 
-void newfs_dump_data_map()
+void newfs_dump_volume_stat()
 {
-    int byte_cursor = 0;
-    int bit_cursor = 0;
+    struct ddriver_stats stats;
+    struct ddriver_vtime vtime;
+    int i;
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.data_map_blks);
-         byte_cursor += 4)
+    printf("volume raid: %d, members: %d, stripe: %d, size: %ld, split: %ld, chunks: %ld, read retry: %ld\n",
+           newfs_volume.level, newfs_volume.nr_members, newfs_volume.stripe_sz, (long)newfs_volume.size,
+           newfs_volume.split_cnt, newfs_volume.chunk_cnt, newfs_volume.retry_cnt);
+    if (newfs_volume.nr_parity > 0)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+        printf("parity: %d, full-stripe writes: %ld, partial writes: %ld, reconstructs: %ld\n",
+               newfs_volume.nr_parity, newfs_volume.full_cnt, newfs_volume.rmw_cnt, newfs_volume.recon_cnt);
+    }
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        if (newfs_volume.members[i].failed)
         {
-            printf("%d ", (newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) >> bit_cursor);
+            printf("  [%d] %s failed\n", i, newfs_volume.members[i].path);
+            continue;
         }
-        printf("\t");
+        if (ddriver_ioctl(NFS_MEMBER_FD(i), IOC_REQ_DEVICE_STATS, &stats) != 0 ||
+            ddriver_ioctl(NFS_MEMBER_FD(i), IOC_REQ_DEVICE_VTIME, &vtime) != 0)
+        {
+            continue;
+        }
+        printf("  [%d] %s read: %lu/%luB, write: %lu/%luB, seek: %lu, busy: %ldus\n",
+               i, newfs_volume.members[i].path, stats.read_cnt, stats.read_bytes,
+               stats.write_cnt, stats.write_bytes, stats.seek_cnt, (long)vtime.total_ns / 1000);
+    }
+}
+
+void newfs_dump_tier_stat()
+{
+    struct ddriver_stats stats;
+    struct ddriver_vtime vtime;
+    int used = 0;
+    int i;
+
+    if (newfs_tier.blk_sz == 0)
+    {
+        return;
+    }
+    for (i = 0; i < newfs_tier.nr_slots; i++)
+    {
+        used += newfs_tier.slot_blk[i] >= 0;
+    }
+    printf("tier fast: %s, pinned: %ldB, slots: %d/%d, promote: %ld, demote: %ld, writeback: %ld\n",
+           newfs_tier.path, (long)(newfs_tier.pin_len + newfs_tier.nr_grps * newfs_tier.grp_pin), used, newfs_tier.nr_slots,
+           newfs_tier.promote_cnt, newfs_tier.demote_cnt, newfs_tier.writeback_cnt);
+    printf("tier access pinned: %ld, fast: %ld, slow: %ld\n",
+           newfs_tier.pin_cnt, newfs_tier.fast_cnt, newfs_tier.slow_cnt);
+    if (ddriver_ioctl(newfs_tier.fd, IOC_REQ_DEVICE_STATS, &stats) == 0 &&
+        ddriver_ioctl(newfs_tier.fd, IOC_REQ_DEVICE_VTIME, &vtime) == 0)
+    {
+        printf("  [fast] read: %lu/%luB, write: %lu/%luB, seek: %lu, busy: %ldus\n",
+               stats.read_cnt, stats.read_bytes, stats.write_cnt, stats.write_bytes,
+               stats.seek_cnt, (long)vtime.total_ns / 1000);
+    }
+}
 
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+void newfs_dump_space_stat()
+{
+    int64_t largest = 0;
+    int loaded = 0;
+    int i;
+
+    for (i = 0; i < newfs_space.nr_exts; i++)
+    {
+        if (newfs_space.exts[i]->len > largest)
+        {
+            largest = newfs_space.exts[i]->len;
+        }
+    }
+    printf("space free blks: %ld/%ld, extents: %d, largest: %ld, free inos: %ld\n",
+           (long)newfs_space.free_blks, (long)newfs_super.data_blks, newfs_space.nr_exts,
+           (long)largest, (long)newfs_space.free_inos);
+    for (i = 0; i < newfs_super.nr_groups; i++)
+    {
+        loaded += newfs_super.groups[i].map != NULL;
+    }
+    printf("groups loaded: %d/%ld\n", loaded, (long)newfs_super.nr_groups);
+}
+
+struct dir_walk
+{
+    int64_t head; /* 上一块之后的块号 */
+    int64_t lo, hi;
+    int64_t seeks, blks;
+};
+
+static void dir_walk_visit(struct dir_walk *walk, int64_t blk)
+{
+    walk->seeks += blk != walk->head;
+    walk->head = blk + 1;
+    walk->lo = blk < walk->lo ? blk : walk->lo;
+    walk->hi = blk > walk->hi ? blk : walk->hi;
+    walk->blks++;
+}
+
+/**
+ * @brief 按ls -l后逐个读文件的顺序走一遍目录涉及的块：目录的inode与目录块，
+ * 再是各子项的inode与数据块；与ddriver的计法相同，不紧接上一块即记一次寻道
+ *
+ * @param dir 已读入inode的目录
+ */
+void newfs_dump_dir_locality(struct newfs_dentry *dir)
+{
+    struct dir_walk walk = {-1, INT64_MAX, 0, 0, 0};
+    struct newfs_inode_d inode_buf;
+    const struct newfs_inode_d *inode_d;
+    struct newfs_dentry *child;
+    int i;
+
+    if (dir->inode == NULL)
+    {
+        return;
+    }
+    dir_walk_visit(&walk, NFS_INO_OFS(dir->ino) / NFS_LOGIC_SZ());
+    for (i = 0; i < dir->inode->size; i++)
+    {
+        dir_walk_visit(&walk, NFS_DATA_BLK(dir->inode->block_pointer[i]));
+    }
+    for (child = dir->inode->dentrys; child; child = child->brother)
+    {
+        dir_walk_visit(&walk, NFS_INO_OFS(child->ino) / NFS_LOGIC_SZ());
+        inode_d = (const struct newfs_inode_d *)newfs_driver_peek(NFS_INO_OFS(child->ino), sizeof(struct newfs_inode_d),
+                                                                  (uint8_t *)&inode_buf);
+        if (inode_d == NULL || child->ftype != NFS_REG_FILE)
         {
-            printf("%d ", (newfs_super.map_data[byte_cursor + 1] & (0x1 << bit_cursor)) >> bit_cursor);
+            continue;
         }
-        printf("\t");
+        for (i = 0; i < inode_d->size; i++)
+        {
+            dir_walk_visit(&walk, NFS_DATA_BLK(inode_d->block_pointer[i]));
+        }
+    }
+    printf("dir %s: ino %d in group %ld, entries: %d, blks: %ld, seeks: %ld, span: %ld blks\n",
+           dir->name, dir->ino, (long)NFS_INO_GROUP(dir->ino), dir->inode->dir_cnt, (long)walk.blks,
+           (long)walk.seeks, (long)(walk.hi - walk.lo + 1));
+}
+
+/**
+ * @brief 原先逐位从头扫描的分配，作为基准的对照
+ *
+ * @param map
+ * @param nbits
+ * @return int64_t
+ */
+static int64_t bench_bit_scan(uint8_t *map, int64_t nbits)
+{
+    int64_t bit;
 
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+    for (bit = 0; bit < nbits; bit++)
+    {
+        if ((map[bit / UINT8_BITS] & (0x1 << (bit % UINT8_BITS))) == 0)
         {
-            printf("%d ", (newfs_super.map_data[byte_cursor + 2] & (0x1 << bit_cursor)) >> bit_cursor);
+            map[bit / UINT8_BITS] |= (uint8_t)(0x1 << (bit % UINT8_BITS));
+            return bit;
         }
-        printf("\t");
+    }
+    return -1;
+}
+
+static double bench_now()
+{
+    struct timespec ts;
 
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 位图分配微基准：按各占用率随机填充位图后连续分配，
+ * 对比按字next-fit与逐位扫描每秒的分配次数
+ */
+void newfs_bench_bitmap()
+{
+    static const int fills[] = {0, 50, 90, 99};
+    const int64_t nbits = 1 << 18;
+    const int nr_allocs = 1024;
+    uint8_t *origin = (uint8_t *)malloc(nbits / UINT8_BITS);
+    uint8_t *map = (uint8_t *)malloc(nbits / UINT8_BITS);
+    uint32_t seed = 1;
+    double start, word_sec, scan_sec;
+    int64_t hint, bit;
+    int i, j;
+
+    if (origin == NULL || map == NULL)
+    {
+        free(origin);
+        free(map);
+        return;
+    }
+    for (i = 0; i < (int)(sizeof(fills) / sizeof(fills[0])); i++)
+    {
+        for (bit = 0; bit < nbits; bit++)
         {
-            printf("%d ", (newfs_super.map_data[byte_cursor + 3] & (0x1 << bit_cursor)) >> bit_cursor);
+            seed = seed * 1103515245 + 12345;
+            if ((int)((seed >> 16) % 100) < fills[i])
+            {
+                origin[bit / UINT8_BITS] |= (uint8_t)(0x1 << (bit % UINT8_BITS));
+            }
+            else
+            {
+                origin[bit / UINT8_BITS] &= (uint8_t)(~(0x1 << (bit % UINT8_BITS)));
+            }
         }
-        printf("\n");
+
+        memcpy(map, origin, nbits / UINT8_BITS);
+        hint = 0;
+        start = bench_now();
+        for (j = 0; j < nr_allocs && newfs_bitmap_alloc(map, nbits, &hint) >= 0; j++)
+            ;
+        word_sec = bench_now() - start;
+
+        memcpy(map, origin, nbits / UINT8_BITS);
+        start = bench_now();
+        for (j = 0; j < nr_allocs && bench_bit_scan(map, nbits) >= 0; j++)
+            ;
+        scan_sec = bench_now() - start;
+
+        printf("bitmap bits: %ld, used: %ld (%d%%), allocs: %d, next-fit: %.0f/s, bit scan: %.0f/s\n",
+               (long)nbits, (long)newfs_bitmap_count(origin, nbits), fills[i], j,
+               j / (word_sec > 0 ? word_sec : 1e-9), j / (scan_sec > 0 ? scan_sec : 1e-9));
     }
-}
\ No newline at end of file
+    free(origin);
+    free(map);
+}
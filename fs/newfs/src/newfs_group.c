@@ -0,0 +1,310 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super;
+extern struct newfs_space newfs_space;
+
+/******************************************************************************
+ * SECTION: 内部函数
+ *******************************************************************************/
+#define NFS_ORLOV_DIR_SLACK(ipg) ((ipg) / 16) /* 子目录留在父组时，组内目录数可高出平均的量 */
+#define NFS_ORLOV_FREE_SLACK(n) ((n) / 4)     /* 子目录留在父组时，空闲可低于平均的量 */
+
+/**
+ * @brief 名字的FNV-1a散列，决定顶层目录从哪个组找起
+ *
+ * @param name
+ * @return int64_t 非负
+ */
+static int64_t group_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    while (*name)
+    {
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    }
+    return h & INT32_MAX;
+}
+
+/**
+ * @brief 将第g组的两块位图一次写回，此后该组不再是未初始化的
+ *
+ * @param g
+ * @return int
+ */
+static int group_store(int64_t g)
+{
+    struct newfs_group *grp = &newfs_super.groups[g];
+
+    if (newfs_driver_write(NFS_BLKS_SZ(NFS_GROUP_OFS(g)), grp->map,
+                           NFS_BLKS_SZ(NFS_GROUP_MAP_BLKS)) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    grp->dirty = FALSE;
+    newfs_super.gdt[g].flags &= ~NFS_GROUP_UNINIT;
+    return NFS_ERROR_NONE;
+}
+
+/******************************************************************************
+ * SECTION: 块组接口
+ *******************************************************************************/
+/**
+ * @brief 读入组描述符表，新格式化时按各组容量填写，位图留到首次使用时再建
+ *
+ * @param is_init 是否新格式化
+ * @return int
+ */
+int newfs_group_init(boolean is_init)
+{
+    int64_t g;
+
+    newfs_super.gdt = (struct newfs_group_d *)malloc(NFS_BLKS_SZ(newfs_super.gdt_blks));
+    newfs_super.groups = (struct newfs_group *)calloc(newfs_super.nr_groups, sizeof(struct newfs_group));
+    if (newfs_super.gdt == NULL || newfs_super.groups == NULL)
+    {
+        newfs_group_destroy();
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (!is_init)
+    {
+        if (newfs_driver_read(NFS_BLKS_SZ(newfs_super.gdt_offset), (uint8_t *)newfs_super.gdt,
+                              NFS_BLKS_SZ(newfs_super.gdt_blks)) != NFS_ERROR_NONE)
+        {
+            newfs_group_destroy();
+            return -NFS_ERROR_IO;
+        }
+        return NFS_ERROR_NONE;
+    }
+    memset(newfs_super.gdt, 0, NFS_BLKS_SZ(newfs_super.gdt_blks));
+    for (g = 0; g < newfs_super.nr_groups; g++)
+    {
+        newfs_super.gdt[g].free_blks = newfs_group_data_blks(g);
+        newfs_super.gdt[g].free_inos = newfs_super.ino_per_group;
+        newfs_super.gdt[g].flags = NFS_GROUP_UNINIT;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 取第g组，位图未载入时读入并登记其空闲段
+ *
+ * @param g
+ * @return struct newfs_group* 内存不足或读盘失败时返回NULL
+ */
+struct newfs_group *newfs_group_get(int64_t g)
+{
+    struct newfs_group *grp = &newfs_super.groups[g];
+
+    if (grp->map != NULL)
+    {
+        return grp;
+    }
+    grp->map = (uint8_t *)malloc(NFS_BLKS_SZ(NFS_GROUP_MAP_BLKS));
+    if (grp->map == NULL)
+    {
+        return NULL;
+    }
+    if (newfs_super.gdt[g].flags & NFS_GROUP_UNINIT)
+    {
+        memset(grp->map, 0, NFS_BLKS_SZ(NFS_GROUP_MAP_BLKS));
+    }
+    else if (newfs_driver_read(NFS_BLKS_SZ(NFS_GROUP_OFS(g)), grp->map,
+                               NFS_BLKS_SZ(NFS_GROUP_MAP_BLKS)) != NFS_ERROR_NONE)
+    {
+        free(grp->map);
+        grp->map = NULL;
+        return NULL;
+    }
+    if (newfs_space_load(g) != NFS_ERROR_NONE)
+    {
+        free(grp->map);
+        grp->map = NULL;
+        return NULL;
+    }
+    return grp;
+}
+
+/**
+ * @brief 第g组的数据块数，末组可能少于data_per_group
+ *
+ * @param g
+ * @return int64_t
+ */
+int64_t newfs_group_data_blks(int64_t g)
+{
+    int64_t left = newfs_super.data_blks - g * newfs_super.data_per_group;
+    return left < newfs_super.data_per_group ? left : newfs_super.data_per_group;
+}
+
+/**
+ * @brief 选定新inode所在的组。普通文件放在父目录的组里，与目录项相邻；
+ * 顶层目录按Orlov的做法分散到空闲高于平均、目录最少的组，为各自的子树留出空间；
+ * 更深的目录留在父目录附近，除非那里目录已多或空闲已少
+ *
+ * @param dentry 父目录已设好的dentry，根目录的parent为NULL
+ * @return int64_t 组号，之后从该组起分配
+ */
+int64_t newfs_group_find(struct newfs_dentry *dentry)
+{
+    int64_t ng = newfs_super.nr_groups;
+    int64_t avg_inos = newfs_space.free_inos / ng;
+    int64_t avg_blks = newfs_space.free_blks / ng;
+    struct newfs_group_d *gd;
+    int64_t parent, best, max_dirs, dirs, g, i;
+
+    if (dentry->parent == NULL)
+    {
+        return 0;
+    }
+    parent = NFS_INO_GROUP(dentry->parent->ino);
+    if (dentry->ftype != NFS_DIR)
+    {
+        for (i = 0; i < ng; i++)
+        {
+            gd = &newfs_super.gdt[(parent + i) % ng];
+            if (gd->free_inos > 0 && gd->free_blks > 0)
+            {
+                return (parent + i) % ng;
+            }
+        }
+        return parent;
+    }
+    if (dentry->parent->parent == NULL)
+    {
+        /* 起点取名字的散列，同一批顶层目录不会都从0组挤起 */
+        best = -1;
+        for (i = 0; i < ng; i++)
+        {
+            g = (group_hash(dentry->name) + i) % ng;
+            gd = &newfs_super.gdt[g];
+            if (gd->free_inos > 0 && gd->free_inos >= avg_inos && gd->free_blks >= avg_blks &&
+                (best < 0 || gd->nr_dirs < newfs_super.gdt[best].nr_dirs))
+            {
+                best = g;
+            }
+        }
+        if (best >= 0)
+        {
+            return best;
+        }
+    }
+    else
+    {
+        for (dirs = 0, g = 0; g < ng; g++)
+        {
+            dirs += newfs_super.gdt[g].nr_dirs;
+        }
+        max_dirs = dirs / ng + NFS_ORLOV_DIR_SLACK(newfs_super.ino_per_group);
+        for (i = 0; i < ng; i++)
+        {
+            gd = &newfs_super.gdt[(parent + i) % ng];
+            if (gd->nr_dirs < max_dirs && gd->free_inos > 0 &&
+                gd->free_inos >= avg_inos - NFS_ORLOV_FREE_SLACK(newfs_super.ino_per_group) &&
+                gd->free_blks >= avg_blks - NFS_ORLOV_FREE_SLACK(newfs_super.data_per_group))
+            {
+                return (parent + i) % ng;
+            }
+        }
+    }
+    /* 各组都偏满时，退回第一个空闲inode不低于平均的组 */
+    for (i = 0; i < ng; i++)
+    {
+        gd = &newfs_super.gdt[(parent + i) % ng];
+        if (gd->free_inos > 0 && gd->free_inos >= avg_inos)
+        {
+            return (parent + i) % ng;
+        }
+    }
+    return parent;
+}
+
+/**
+ * @brief 从第g组起分配一个inode，组内按各自的游标next-fit，
+ * 按描述符跳过已满的组而不载入其位图
+ *
+ * @param g 由newfs_group_find选定的组
+ * @param is_dir 是否为目录，计入组的目录数
+ * @return int64_t ino，没有空闲inode时返回-1
+ */
+int64_t newfs_group_alloc_inode(int64_t g, boolean is_dir)
+{
+    int64_t ipg = newfs_super.ino_per_group;
+    struct newfs_group *grp;
+    int64_t i, bit;
+
+    for (i = 0; i < newfs_super.nr_groups; i++, g = (g + 1) % newfs_super.nr_groups)
+    {
+        if (newfs_super.gdt[g].free_inos == 0 || (grp = newfs_group_get(g)) == NULL)
+        {
+            continue;
+        }
+        bit = newfs_bitmap_alloc(NFS_GROUP_INO_MAP(grp), ipg, &grp->ino_hint);
+        if (bit < 0)
+        {
+            continue;
+        }
+        newfs_super.gdt[g].free_inos--;
+        newfs_super.gdt[g].nr_dirs += is_dir ? 1 : 0;
+        newfs_space.free_inos--;
+        grp->dirty = TRUE;
+        return g * ipg + bit;
+    }
+    return -1;
+}
+
+/**
+ * @brief 释放一个inode
+ *
+ * @param ino
+ * @param is_dir 是否为目录
+ */
+void newfs_group_free_inode(int64_t ino, boolean is_dir)
+{
+    int64_t g = ino / newfs_super.ino_per_group;
+    struct newfs_group *grp = newfs_group_get(g);
+
+    if (grp == NULL || !newfs_bitmap_test(NFS_GROUP_INO_MAP(grp), ino % newfs_super.ino_per_group))
+    {
+        return;
+    }
+    newfs_bitmap_clear(NFS_GROUP_INO_MAP(grp), ino % newfs_super.ino_per_group);
+    newfs_super.gdt[g].free_inos++;
+    newfs_super.gdt[g].nr_dirs -= is_dir ? 1 : 0;
+    newfs_space.free_inos++;
+    grp->dirty = TRUE;
+}
+
+/**
+ * @brief 只写回改动过的组位图，再写回组描述符表
+ *
+ * @return int
+ */
+int newfs_group_flush()
+{
+    int64_t g;
+
+    for (g = 0; g < newfs_super.nr_groups; g++)
+    {
+        if (newfs_super.groups[g].dirty && group_store(g) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return newfs_driver_write(NFS_BLKS_SZ(newfs_super.gdt_offset), (uint8_t *)newfs_super.gdt,
+                              NFS_BLKS_SZ(newfs_super.gdt_blks));
+}
+
+void newfs_group_destroy()
+{
+    int64_t g;
+
+    for (g = 0; newfs_super.groups != NULL && g < newfs_super.nr_groups; g++)
+    {
+        free(newfs_super.groups[g].map);
+    }
+    free(newfs_super.groups);
+    free(newfs_super.gdt);
+    newfs_super.groups = NULL;
+    newfs_super.gdt = NULL;
+}
@@ -0,0 +1,206 @@
+#include "newfs.h"
+
+static uint8_t gf_exp[512]; /* g^i，两倍长度省去乘法中的取模 */
+static uint8_t gf_log[256];
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+/******************************************************************************
+ * SECTION: 内部函数
+ *******************************************************************************/
+/**
+ * @brief 生成GF(2^8)的指数与对数表，生成元g = 2，本原多项式0x11d
+ */
+static void gf_init()
+{
+    int x = 1;
+    int i;
+
+    for (i = 0; i < 255; i++)
+    {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+        {
+            x ^= 0x11d;
+        }
+    }
+    for (i = 255; i < 512; i++)
+    {
+        gf_exp[i] = gf_exp[i - 255];
+    }
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    return a == 0 || b == 0 ? 0 : gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_div(uint8_t a, uint8_t b)
+{
+    return a == 0 ? 0 : gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+/**
+ * @brief 一个64位字内的8个字节各自在GF(2^8)中乘g，
+ * 最高位溢出的字节异或上0x1d，字节之间互不进位
+ *
+ * @param v
+ * @return uint64_t
+ */
+static inline uint64_t gf_mul2_word(uint64_t v)
+{
+    uint64_t high = v & 0x8080808080808080ULL;
+    return ((v << 1) & 0xfefefefefefefefeULL) ^ ((high >> 7) * 0x1d);
+}
+
+/**
+ * @brief dst = coef · src，逐字节查表，只用于降级重建
+ *
+ * @param dst
+ * @param src
+ * @param coef
+ * @param len
+ */
+static void gf_scale(uint8_t *dst, const uint8_t *src, uint8_t coef, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        dst[i] = gf_mul(coef, src[i]);
+    }
+}
+
+/******************************************************************************
+ * SECTION: 校验接口
+ *******************************************************************************/
+/**
+ * @brief 由k个数据单元生成P = ΣD_i，m为2时再生成Q = Σg^i·D_i；
+ * 按64位字同时处理8个字节，Q按Horner法则从最高编号的单元累积
+ *
+ * @param units units[0..k-1]为数据，units[k]为P，units[k+1]为Q
+ * @param k 数据单元数
+ * @param m 校验单元数，1或2
+ * @param len 8的整数倍
+ */
+void newfs_parity_gen(uint8_t **units, int k, int m, int len)
+{
+    uint64_t pv, qv, dv;
+    int i, j;
+
+    /* 整行写直接引用调用者的缓冲区，按memcpy取字以免非对齐访问 */
+    for (j = 0; j < len; j += sizeof(uint64_t))
+    {
+        pv = 0;
+        qv = 0;
+        for (i = k - 1; i >= 0; i--)
+        {
+            memcpy(&dv, units[i] + j, sizeof(uint64_t));
+            pv ^= dv;
+            qv = gf_mul2_word(qv) ^ dv;
+        }
+        memcpy(units[k] + j, &pv, sizeof(uint64_t));
+        if (m > 1)
+        {
+            memcpy(units[k + 1] + j, &qv, sizeof(uint64_t));
+        }
+    }
+}
+
+/**
+ * @brief 由其余单元重建缺失的单元，缺失的校验单元一并重新生成
+ *
+ * @param units 同newfs_parity_gen，缺失单元的内容可为任意值
+ * @param k 数据单元数
+ * @param m 校验单元数，1或2
+ * @param len 8的整数倍
+ * @param missing 缺失单元的下标
+ * @param nr_missing 不超过m
+ * @return int
+ */
+int newfs_parity_rebuild(uint8_t **units, int k, int m, int len, const int *missing, int nr_missing)
+{
+    uint8_t *saved;
+    uint8_t *p = units[k];
+    uint8_t *q = m > 1 ? units[k + 1] : NULL;
+    uint8_t gyx, denom, coef;
+    int data[2];
+    int nr_data = 0;
+    boolean p_missing = FALSE;
+    int i;
+
+    pthread_once(&gf_once, gf_init);
+    if (nr_missing > m)
+    {
+        return -NFS_ERROR_IO;
+    }
+    for (i = 0; i < nr_missing; i++)
+    {
+        if (missing[i] < k)
+        {
+            data[nr_data++] = missing[i];
+        }
+        else if (missing[i] == k)
+        {
+            p_missing = TRUE;
+        }
+    }
+    if (nr_data == 0)
+    {
+        newfs_parity_gen(units, k, m, len);
+        return NFS_ERROR_NONE;
+    }
+
+    /* 缺失的数据单元先置零，此时生成的校验即其余单元的贡献 */
+    saved = (uint8_t *)malloc(2 * len);
+    if (saved == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    memcpy(saved, p, len);
+    if (q != NULL)
+    {
+        memcpy(saved + len, q, len);
+    }
+    for (i = 0; i < nr_data; i++)
+    {
+        memset(units[data[i]], 0, len);
+    }
+    newfs_parity_gen(units, k, m, len);
+    for (i = 0; i < len; i++)
+    {
+        saved[i] ^= p[i];
+        if (q != NULL)
+        {
+            saved[len + i] ^= q[i];
+        }
+    }
+
+    if (nr_data == 1 && !p_missing)
+    {
+        /* D_x = P ⊕ Σ(i≠x)D_i */
+        memcpy(units[data[0]], saved, len);
+    }
+    else if (nr_data == 1)
+    {
+        /* D_x = (Q ⊕ Σ(i≠x)g^i·D_i)·g^-x */
+        gf_scale(units[data[0]], saved + len, gf_exp[255 - data[0]], len);
+    }
+    else
+    {
+        /* 两个数据单元x<y缺失：D_x = A·Pxy ⊕ B·Qxy，D_y = Pxy ⊕ D_x */
+        gyx = gf_exp[data[1] - data[0]];
+        denom = gyx ^ 1;
+        coef = gf_div(gf_exp[255 - data[0]], denom);
+        gf_scale(units[data[0]], saved, gf_div(gyx, denom), len);
+        for (i = 0; i < len; i++)
+        {
+            units[data[0]][i] ^= gf_mul(coef, saved[len + i]);
+            units[data[1]][i] = saved[i] ^ units[data[0]][i];
+        }
+    }
+    free(saved);
+    newfs_parity_gen(units, k, m, len);
+    return NFS_ERROR_NONE;
+}
@@ -0,0 +1,173 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super;
+
+struct newfs_slab newfs_dentry_slab = NFS_SLAB_INIT(struct newfs_dentry);
+struct newfs_slab newfs_inode_slab = NFS_SLAB_INIT(struct newfs_inode);
+struct newfs_slab newfs_extent_slab = NFS_SLAB_INIT(struct newfs_free_ext);
+struct newfs_pool_stat newfs_pool_stat;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+/******************************************************************************
+ * SECTION: 线程私有的对齐暂存区
+ *******************************************************************************/
+static void scratch_release(void *arg)
+{
+    struct newfs_scratch *scratch = (struct newfs_scratch *)arg;
+    free(scratch->buf);
+    free(scratch);
+}
+
+static void scratch_key_init()
+{
+    pthread_key_create(&scratch_key, scratch_release);
+}
+
+/**
+ * @brief 获取当前线程的暂存区，大小不足时按IO单元对齐扩容
+ *
+ * 同一线程内返回的是同一块内存，调用者不得持有跨越另一次
+ * newfs_scratch_get 的指针，也不需要释放
+ *
+ * @param size 需要的字节数
+ * @return uint8_t* 失败返回NULL
+ */
+uint8_t *newfs_scratch_get(int size)
+{
+    struct newfs_scratch *scratch;
+    void *buf;
+    int cap;
+
+    pthread_once(&scratch_once, scratch_key_init);
+    scratch = (struct newfs_scratch *)pthread_getspecific(scratch_key);
+    if (scratch == NULL)
+    {
+        scratch = (struct newfs_scratch *)calloc(1, sizeof(struct newfs_scratch));
+        if (scratch == NULL)
+        {
+            return NULL;
+        }
+        pthread_setspecific(scratch_key, scratch);
+    }
+
+    if (scratch->size >= size)
+    {
+        __atomic_fetch_add(&newfs_pool_stat.scratch_hit_cnt, 1, __ATOMIC_RELAXED);
+        return scratch->buf;
+    }
+
+    cap = NFS_ROUND_UP(size, NFS_SCRATCH_MIN_SZ);
+    if (posix_memalign(&buf, NFS_SCRATCH_ALIGN, cap) != 0)
+    {
+        return NULL;
+    }
+    free(scratch->buf);
+    scratch->buf = (uint8_t *)buf;
+    scratch->size = cap;
+    __atomic_fetch_add(&newfs_pool_stat.scratch_grow_cnt, 1, __ATOMIC_RELAXED);
+    return scratch->buf;
+}
+
+/******************************************************************************
+ * SECTION: 定长对象池
+ *******************************************************************************/
+/**
+ * @brief 从对象池取一个清零的对象，空闲链为空时整批申请一个chunk
+ *
+ * @param slab
+ * @return void*
+ */
+void *newfs_slab_alloc(struct newfs_slab *slab)
+{
+    void *obj;
+    void **chunk;
+    int obj_sz = NFS_ROUND_UP(slab->obj_sz, sizeof(void *));
+    int i;
+
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_list == NULL)
+    {
+        /* chunk头部一个指针串起所有chunk，umount时统一释放 */
+        chunk = (void **)malloc(sizeof(void *) + obj_sz * NFS_SLAB_CHUNK_OBJS);
+        if (chunk == NULL)
+        {
+            pthread_mutex_unlock(&slab->lock);
+            return NULL;
+        }
+        *chunk = slab->chunks;
+        slab->chunks = chunk;
+        for (i = NFS_SLAB_CHUNK_OBJS - 1; i >= 0; i--)
+        {
+            obj = (uint8_t *)(chunk + 1) + i * obj_sz;
+            *(void **)obj = slab->free_list;
+            slab->free_list = obj;
+        }
+        slab->malloc_cnt++;
+    }
+    obj = slab->free_list;
+    slab->free_list = *(void **)obj;
+    slab->alloc_cnt++;
+    pthread_mutex_unlock(&slab->lock);
+
+    memset(obj, 0, slab->obj_sz);
+    return obj;
+}
+
+/**
+ * @brief 将对象归还对象池
+ *
+ * @param slab
+ * @param obj
+ */
+void newfs_slab_free(struct newfs_slab *slab, void *obj)
+{
+    if (obj == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&slab->lock);
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+/**
+ * @brief 释放对象池的所有chunk，池中对象一并失效
+ *
+ * @param slab
+ */
+void newfs_slab_destroy(struct newfs_slab *slab)
+{
+    void **chunk;
+
+    pthread_mutex_lock(&slab->lock);
+    while (slab->chunks)
+    {
+        chunk = (void **)slab->chunks;
+        slab->chunks = *chunk;
+        free(chunk);
+    }
+    slab->free_list = NULL;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+/**
+ * @brief 创建一个dentry
+ *
+ * @param fname 文件名
+ * @param ftype 文件类型
+ * @return struct newfs_dentry*
+ */
+struct newfs_dentry *new_dentry(char *fname, NFS_FILE_TYPE ftype)
+{
+    struct newfs_dentry *dentry = (struct newfs_dentry *)newfs_slab_alloc(&newfs_dentry_slab);
+    NFS_ASSIGN_FNAME(dentry, fname);
+    dentry->ftype = ftype;
+    dentry->ino = -1;
+    dentry->inode = NULL;
+    dentry->parent = NULL;
+    dentry->brother = NULL;
+    return dentry;
+}
@@ -0,0 +1,489 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super;
+extern struct newfs_sched newfs_sched;
+extern struct newfs_volume newfs_volume;
+
+/******************************************************************************
+ * SECTION: 内部函数
+ *******************************************************************************/
+static int req_cmp(const void *a, const void *b)
+{
+    int64_t lhs = newfs_sched.reqs[*(const int *)a].offset;
+    int64_t rhs = newfs_sched.reqs[*(const int *)b].offset;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static int dno_cmp(const void *a, const void *b)
+{
+    int64_t lhs = *(const int64_t *)a;
+    int64_t rhs = *(const int64_t *)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/**
+ * @brief 丢弃一段连续的数据块，先作废其缓存，避免脏块之后又被写回
+ *
+ * @param dno 起始数据块号
+ * @param blk_cnt 块数
+ * @return int
+ */
+static int discard_run(int64_t dno, int64_t blk_cnt)
+{
+    newfs_cache_invalidate(NFS_DATA_BLK(dno), blk_cnt);
+    if (newfs_tier_discard(NFS_DATA_OFS(dno), NFS_BLKS_SZ(blk_cnt)) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    newfs_sched.discard_cnt++;
+    newfs_sched.discard_blks += blk_cnt;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 收割至少min_nr个完成的设备请求，归还其槽位；
+ * 每次等待在途请求最多的成员，其余成员的请求同时在设备上推进
+ *
+ * @param min_nr
+ * @return int
+ */
+static int aio_reap(int min_nr)
+{
+    struct ddriver_req *done[DDRIVER_QUEUE_DEPTH];
+    int member;
+    int nr_done;
+    int want;
+    int i;
+    int ret = NFS_ERROR_NONE;
+
+    while (min_nr > 0)
+    {
+        member = 0;
+        for (i = 1; i < newfs_volume.nr_members; i++)
+        {
+            if (newfs_sched.member_inflight[i] > newfs_sched.member_inflight[member])
+            {
+                member = i;
+            }
+        }
+        if (newfs_sched.member_inflight[member] == 0)
+        {
+            return -NFS_ERROR_IO;
+        }
+        want = min_nr < newfs_sched.member_inflight[member] ? min_nr : newfs_sched.member_inflight[member];
+        nr_done = ddriver_wait(NFS_MEMBER_FD(member), done, want, DDRIVER_QUEUE_DEPTH);
+        if (nr_done < want)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+        for (i = 0; i < nr_done; i++)
+        {
+            /* 镜像卷中失败的成员被摘除，其余副本已写成 */
+            if (done[i]->res != (int)done[i]->size)
+            {
+                NFS_DBG("[%s] aio write %ld failed: %d\n", __func__, (long)done[i]->offset, done[i]->res);
+                if (newfs_vol_fail(member) != NFS_ERROR_NONE)
+                {
+                    ret = -NFS_ERROR_IO;
+                }
+            }
+            newfs_sched.aio_free[newfs_sched.nr_aio_free++] = done[i];
+            newfs_sched.member_inflight[member]--;
+            newfs_sched.nr_inflight--;
+        }
+        if (nr_done <= 0)
+        {
+            break;
+        }
+        min_nr -= nr_done;
+    }
+    return ret;
+}
+
+/**
+ * @brief 异步下发一次设备写，按卷的布局拆到各成员，队列满时先收割完成的请求；
+ * 分层时落在快层的部分同步写入
+ *
+ * @param offset
+ * @param buf 完成前须保持有效
+ * @param size
+ * @return int
+ */
+static int aio_write(int64_t offset, uint8_t *buf, int size)
+{
+    struct ddriver_req *req;
+    int members[NFS_VOL_MAX_MEMBERS];
+    int64_t member_off;
+    int nr_members;
+    int run = 0;
+    int len;
+    int i;
+    int ret = NFS_ERROR_NONE;
+
+    while (size > 0)
+    {
+        /* run为分层确认可按原偏移写慢层卷的剩余长度，同步写入时nr_members为0 */
+        nr_members = 0;
+        if (run == 0 && !newfs_tier_map_write(offset, size, &run))
+        {
+            if (newfs_tier_pwrite(offset, buf, run) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+            len = run;
+        }
+        else if ((nr_members = newfs_vol_map_write(offset, run, members, &member_off, &len)) == 0)
+        {
+            /* 校验卷须连同校验一起写，整行直接写入、部分行先读后写，交给卷层同步完成 */
+            if (newfs_vol_pwrite(offset, buf, run) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+            len = run;
+        }
+        for (i = 0; i < nr_members; i++)
+        {
+            if (newfs_sched.nr_aio_free == 0 && aio_reap(1) != NFS_ERROR_NONE)
+            {
+                ret = -NFS_ERROR_IO;
+                if (newfs_sched.nr_aio_free == 0)
+                {
+                    return ret;
+                }
+            }
+            req = newfs_sched.aio_free[--newfs_sched.nr_aio_free];
+            req->op = DDRIVER_OP_WRITE;
+            req->buf = (char *)buf;
+            req->size = len;
+            req->offset = member_off;
+            if (ddriver_submit(NFS_MEMBER_FD(members[i]), &req, 1) != 1)
+            {
+                newfs_sched.aio_free[newfs_sched.nr_aio_free++] = req;
+                if (newfs_vol_fail(members[i]) != NFS_ERROR_NONE)
+                {
+                    return -NFS_ERROR_IO;
+                }
+                continue;
+            }
+            newfs_sched.member_inflight[members[i]]++;
+            newfs_sched.nr_inflight++;
+            if (newfs_sched.nr_inflight > newfs_sched.max_inflight)
+            {
+                newfs_sched.max_inflight = newfs_sched.nr_inflight;
+            }
+        }
+        offset += len;
+        buf += len;
+        size -= len;
+        run -= len;
+    }
+    newfs_sched.head = offset;
+    return ret;
+}
+
+/**
+ * @brief 将按偏移相邻的若干请求合并为一次设备写
+ *
+ * @param idx 按偏移排序的请求索引
+ * @param from 起始位置
+ * @param to 结束位置（含）
+ * @return int
+ */
+static int dispatch_run(int *idx, int from, int to)
+{
+    struct newfs_io_req *first = &newfs_sched.reqs[idx[from]];
+    uint8_t *gather;
+    int size = 0;
+    int i;
+
+    if (from == to)
+    {
+        newfs_sched.dispatch_cnt++;
+        return aio_write(first->offset, first->buf, first->size);
+    }
+
+    /* 拼接区在newfs_sched_dispatch中按总量一次备好，各合并请求依次切分 */
+    gather = newfs_sched.gather + newfs_sched.gather_off;
+    for (i = from; i <= to; i++)
+    {
+        memcpy(gather + size, newfs_sched.reqs[idx[i]].buf, newfs_sched.reqs[idx[i]].size);
+        size += newfs_sched.reqs[idx[i]].size;
+    }
+    newfs_sched.gather_off += size;
+    newfs_sched.dispatch_cnt++;
+    newfs_sched.merge_cnt += to - from;
+    return aio_write(first->offset, gather, size);
+}
+
+/**
+ * @brief 以C-SCAN顺序派发一类请求：从磁头位置单向扫到末尾再回绕，
+ * 提交顺序最早的请求超时后插队派发，避免饿死
+ *
+ * @param idx 按偏移排序的请求索引
+ * @param n 请求个数
+ * @param is_meta 请求类别
+ * @return int
+ */
+static int cscan_dispatch(int *idx, int n, boolean is_meta)
+{
+    struct newfs_io_req *req;
+    int fifo = 0;  /* 按提交顺序扫描的游标 */
+    int batch = 0; /* 插队后继续按偏移顺序派发的剩余请求数 */
+    int pos = 0;
+    int end;
+    int left = n;
+    int ret = NFS_ERROR_NONE;
+
+    while (pos < n && newfs_sched.reqs[idx[pos]].offset < newfs_sched.head)
+    {
+        pos++;
+    }
+
+    while (left > 0)
+    {
+        while (newfs_sched.reqs[fifo].done || newfs_sched.reqs[fifo].is_meta != is_meta)
+        {
+            fifo++;
+        }
+        if (batch <= 0 && newfs_sched.seq > newfs_sched.reqs[fifo].expire)
+        {
+            pos = newfs_sched.reqs[fifo].sorted_idx;
+            batch = NFS_SCHED_FIFO_BATCH;
+            newfs_sched.expire_cnt++;
+        }
+        else
+        {
+            pos %= n;
+            while (newfs_sched.reqs[idx[pos]].done)
+            {
+                pos = (pos + 1) % n;
+            }
+        }
+
+        end = pos;
+        while (end + 1 < n && !newfs_sched.reqs[idx[end + 1]].done &&
+               newfs_sched.reqs[idx[end + 1]].offset ==
+                   newfs_sched.reqs[idx[end]].offset + newfs_sched.reqs[idx[end]].size)
+        {
+            end++;
+        }
+        if (dispatch_run(idx, pos, end) != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+        for (; pos <= end; pos++)
+        {
+            req = &newfs_sched.reqs[idx[pos]];
+            req->done = TRUE;
+            newfs_sched.seq++;
+            batch--;
+            left--;
+        }
+    }
+    return ret;
+}
+
+/******************************************************************************
+ * SECTION: 调度器接口
+ *******************************************************************************/
+/**
+ * @brief 提交一个写请求，直到newfs_sched_dispatch前都不会落盘
+ *
+ * @param offset 按IO单元对齐的偏移
+ * @param buf 待写数据，派发完成前须保持有效
+ * @param size IO单元的整数倍
+ * @return int
+ */
+int newfs_sched_submit_write(int64_t offset, uint8_t *buf, int size)
+{
+    struct newfs_io_req *req;
+    struct newfs_io_req *reqs;
+    int *idx;
+    int cap;
+
+    if (newfs_sched.nr_reqs == newfs_sched.cap)
+    {
+        cap = newfs_sched.cap ? newfs_sched.cap * 2 : 64;
+        reqs = (struct newfs_io_req *)realloc(newfs_sched.reqs, cap * sizeof(struct newfs_io_req));
+        if (reqs == NULL)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        newfs_sched.reqs = reqs;
+        idx = (int *)realloc(newfs_sched.idx, cap * sizeof(int));
+        if (idx == NULL)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        newfs_sched.idx = idx;
+        newfs_sched.cap = cap;
+    }
+
+    req = &newfs_sched.reqs[newfs_sched.nr_reqs++];
+    req->offset = offset;
+    req->size = size;
+    req->buf = buf;
+    req->is_meta = NFS_IS_META_BLK(offset / NFS_LOGIC_SZ());
+    req->done = FALSE;
+    req->expire = newfs_sched.seq + NFS_SCHED_FIFO_EXPIRE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 派发所有排队的请求，元数据先于数据，各自按C-SCAN排序并合并相邻请求，
+ * 经设备异步队列下发，返回时全部已完成
+ *
+ * @return int
+ */
+int newfs_sched_dispatch()
+{
+    int *meta_idx = newfs_sched.idx;
+    int *data_idx;
+    int nr_meta = 0;
+    int nr_data = 0;
+    int total = 0;
+    int i;
+    int ret = NFS_ERROR_NONE;
+
+    if (newfs_sched.nr_reqs == 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+
+    /* 元数据索引从头向后填，数据索引从尾向前填 */
+    for (i = 0; i < newfs_sched.nr_reqs; i++)
+    {
+        if (newfs_sched.reqs[i].is_meta)
+        {
+            meta_idx[nr_meta++] = i;
+        }
+        else
+        {
+            newfs_sched.idx[newfs_sched.nr_reqs - 1 - nr_data++] = i;
+        }
+    }
+    data_idx = newfs_sched.idx + nr_meta;
+
+    /* 设备请求可能同时在途，拼接区按全部请求的总量准备 */
+    newfs_sched.gather = NULL;
+    for (i = 0; i < newfs_sched.nr_reqs; i++)
+    {
+        total += newfs_sched.reqs[i].size;
+    }
+    if (newfs_sched.nr_reqs > 1)
+    {
+        newfs_sched.gather = newfs_scratch_get(total);
+        if (newfs_sched.gather == NULL)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+    }
+    newfs_sched.gather_off = 0;
+    if (newfs_sched.nr_aio_free + newfs_sched.nr_inflight == 0)
+    {
+        for (i = 0; i < DDRIVER_QUEUE_DEPTH; i++)
+        {
+            newfs_sched.aio_free[newfs_sched.nr_aio_free++] = &newfs_sched.aio[i];
+        }
+    }
+
+    qsort(meta_idx, nr_meta, sizeof(int), req_cmp);
+    qsort(data_idx, nr_data, sizeof(int), req_cmp);
+    for (i = 0; i < nr_meta; i++)
+    {
+        newfs_sched.reqs[meta_idx[i]].sorted_idx = i;
+    }
+    for (i = 0; i < nr_data; i++)
+    {
+        newfs_sched.reqs[data_idx[i]].sorted_idx = i;
+    }
+
+    if (nr_meta && cscan_dispatch(meta_idx, nr_meta, TRUE) != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    if (nr_data && cscan_dispatch(data_idx, nr_data, FALSE) != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    /* 元数据与数据共用各成员的设备队列，全部完成后请求中的缓冲区才可复用 */
+    if (newfs_sched.nr_inflight > 0 && aio_reap(newfs_sched.nr_inflight) != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+
+    newfs_sched.nr_reqs = 0;
+    return ret;
+}
+
+/**
+ * @brief 登记一个已释放的数据块，由newfs_sched_discard批量丢弃
+ *
+ * @param dno 数据块号
+ * @return int
+ */
+int newfs_sched_submit_discard(int64_t dno)
+{
+    int64_t *discard;
+    int cap;
+
+    if (newfs_sched.nr_discard == newfs_sched.discard_cap)
+    {
+        cap = newfs_sched.discard_cap ? newfs_sched.discard_cap * 2 : 64;
+        discard = (int64_t *)realloc(newfs_sched.discard, cap * sizeof(int64_t));
+        if (discard == NULL)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        newfs_sched.discard = discard;
+        newfs_sched.discard_cap = cap;
+    }
+    newfs_sched.discard[newfs_sched.nr_discard++] = dno;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将登记的数据块排序并合并成连续区间，每个区间下发一次丢弃；
+ * 须在这些块被重新分配之前调用
+ *
+ * @return int
+ */
+int newfs_sched_discard()
+{
+    int64_t start;
+    int i, j;
+    int ret = NFS_ERROR_NONE;
+
+    qsort(newfs_sched.discard, newfs_sched.nr_discard, sizeof(int64_t), dno_cmp);
+    for (i = 0; i < newfs_sched.nr_discard; i = j)
+    {
+        start = newfs_sched.discard[i];
+        for (j = i + 1; j < newfs_sched.nr_discard &&
+                        newfs_sched.discard[j] == start + (j - i) &&
+                        newfs_sched.discard[j] % newfs_super.data_per_group != 0; j++)
+            ;
+        if (discard_run(start, j - i) != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    newfs_sched.nr_discard = 0;
+    return ret;
+}
+
+/**
+ * @brief 释放调度队列
+ */
+void newfs_sched_destroy()
+{
+    free(newfs_sched.reqs);
+    free(newfs_sched.idx);
+    free(newfs_sched.discard);
+    newfs_sched.reqs = NULL;
+    newfs_sched.idx = NULL;
+    newfs_sched.discard = NULL;
+    newfs_sched.nr_discard = 0;
+    newfs_sched.discard_cap = 0;
+    newfs_sched.nr_reqs = 0;
+    newfs_sched.cap = 0;
+}
@@ -0,0 +1,466 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super;
+extern struct newfs_space newfs_space;
+extern struct newfs_slab newfs_extent_slab;
+
+/******************************************************************************
+ * SECTION: 内部函数
+ *******************************************************************************/
+static int space_bin(int64_t len)
+{
+    int k = 63 - __builtin_clzll((uint64_t)len);
+    return k < NFS_SPACE_BINS ? k : NFS_SPACE_BINS - 1;
+}
+
+static void bin_insert(struct newfs_free_ext *ext)
+{
+    struct newfs_free_ext **head = &newfs_space.bins[space_bin(ext->len)];
+
+    ext->bin_prev = NULL;
+    ext->bin_next = *head;
+    if (*head)
+    {
+        (*head)->bin_prev = ext;
+    }
+    *head = ext;
+}
+
+static void bin_remove(struct newfs_free_ext *ext)
+{
+    if (ext->bin_prev)
+    {
+        ext->bin_prev->bin_next = ext->bin_next;
+    }
+    else
+    {
+        newfs_space.bins[space_bin(ext->len)] = ext->bin_next;
+    }
+    if (ext->bin_next)
+    {
+        ext->bin_next->bin_prev = ext->bin_prev;
+    }
+}
+
+/**
+ * @brief 修改空闲段的范围，长度级别变化时换到对应的链上
+ *
+ * @param ext
+ * @param start
+ * @param len
+ */
+static void ext_resize(struct newfs_free_ext *ext, int64_t start, int64_t len)
+{
+    if (space_bin(len) != space_bin(ext->len))
+    {
+        bin_remove(ext);
+        ext->start = start;
+        ext->len = len;
+        bin_insert(ext);
+        return;
+    }
+    ext->start = start;
+    ext->len = len;
+}
+
+/**
+ * @brief 第一个起点大于blk的空闲段的下标
+ *
+ * @param blk
+ * @return int
+ */
+static int ext_upper(int64_t blk)
+{
+    int lo = 0, hi = newfs_space.nr_exts;
+    int mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (newfs_space.exts[mid]->start <= blk)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief 在下标idx处插入一个空闲段
+ *
+ * @param idx
+ * @param start
+ * @param len
+ * @return int
+ */
+static int ext_insert_at(int idx, int64_t start, int64_t len)
+{
+    struct newfs_free_ext **exts;
+    struct newfs_free_ext *ext;
+
+    if (newfs_space.nr_exts == newfs_space.cap)
+    {
+        exts = (struct newfs_free_ext **)realloc(newfs_space.exts,
+                                                 sizeof(*exts) * (newfs_space.cap ? newfs_space.cap * 2 : 16));
+        if (exts == NULL)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        newfs_space.exts = exts;
+        newfs_space.cap = newfs_space.cap ? newfs_space.cap * 2 : 16;
+    }
+    ext = (struct newfs_free_ext *)newfs_slab_alloc(&newfs_extent_slab);
+    if (ext == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    ext->start = start;
+    ext->len = len;
+    bin_insert(ext);
+    memmove(newfs_space.exts + idx + 1, newfs_space.exts + idx,
+            sizeof(*newfs_space.exts) * (newfs_space.nr_exts - idx));
+    newfs_space.exts[idx] = ext;
+    newfs_space.nr_exts++;
+    return NFS_ERROR_NONE;
+}
+
+static void ext_remove_at(int idx)
+{
+    struct newfs_free_ext *ext = newfs_space.exts[idx];
+
+    bin_remove(ext);
+    memmove(newfs_space.exts + idx, newfs_space.exts + idx + 1,
+            sizeof(*newfs_space.exts) * (newfs_space.nr_exts - idx - 1));
+    newfs_space.nr_exts--;
+    newfs_slab_free(&newfs_extent_slab, ext);
+}
+
+static void space_set_usage()
+{
+    newfs_super.sz_usage = NFS_BLKS_SZ(newfs_super.data_blks - newfs_space.free_blks);
+}
+
+/**
+ * @brief 从下标idx的空闲段中取出[start, start + len)，并占用所在组的位图；
+ * 空闲段不跨组，取出的部分总在一个组内
+ *
+ * @param idx
+ * @param start
+ * @param len
+ * @return int
+ */
+static int ext_carve(int idx, int64_t start, int64_t len)
+{
+    struct newfs_free_ext *ext = newfs_space.exts[idx];
+    int64_t end = ext->start + ext->len;
+    int64_t g;
+
+    if (start > ext->start && start + len < end)
+    {
+        /* 从中间取走，先插入后半段，失败时索引保持原样 */
+        if (ext_insert_at(idx + 1, start + len, end - start - len) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        ext_resize(ext, ext->start, start - ext->start);
+    }
+    else if (len == ext->len)
+    {
+        ext_remove_at(idx);
+    }
+    else if (start == ext->start)
+    {
+        ext_resize(ext, start + len, ext->len - len);
+    }
+    else
+    {
+        ext_resize(ext, ext->start, ext->len - len);
+    }
+    g = start / newfs_super.data_per_group;
+    newfs_bitmap_set_range(NFS_GROUP_DATA_MAP(&newfs_super.groups[g]), start % newfs_super.data_per_group, len);
+    newfs_super.groups[g].dirty = TRUE;
+    newfs_super.gdt[g].free_blks -= len;
+    newfs_space.free_blks -= len;
+    space_set_usage();
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在第k级链上找能容纳want的最短段，同长取起点小的
+ *
+ * @param k
+ * @param want
+ * @return struct newfs_free_ext*
+ */
+static struct newfs_free_ext *bin_best_fit(int k, int64_t want)
+{
+    struct newfs_free_ext *best = NULL;
+    struct newfs_free_ext *ext;
+
+    for (ext = newfs_space.bins[k]; ext; ext = ext->bin_next)
+    {
+        if (ext->len >= want &&
+            (best == NULL || ext->len < best->len || (ext->len == best->len && ext->start < best->start)))
+        {
+            best = ext;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief 已载入各组中最长的空闲段
+ *
+ * @return struct newfs_free_ext*
+ */
+static struct newfs_free_ext *space_largest()
+{
+    struct newfs_free_ext *fit = NULL;
+    struct newfs_free_ext *ext;
+    int k;
+
+    for (k = NFS_SPACE_BINS - 1; k >= 0 && fit == NULL; k--)
+    {
+        for (ext = newfs_space.bins[k]; ext; ext = ext->bin_next)
+        {
+            if (fit == NULL || ext->len > fit->len || (ext->len == fit->len && ext->start < fit->start))
+            {
+                fit = ext;
+            }
+        }
+    }
+    return fit;
+}
+
+/**
+ * @brief 已载入各组中能容纳want的最短段
+ *
+ * @param want
+ * @return struct newfs_free_ext*
+ */
+static struct newfs_free_ext *space_best_fit(int64_t want)
+{
+    struct newfs_free_ext *fit = NULL;
+    int k;
+
+    /* 第space_bin(want)级中可能有短于want的段，更高级别的段都够长 */
+    for (k = space_bin(want); k < NFS_SPACE_BINS && fit == NULL; k++)
+    {
+        fit = bin_best_fit(k, want);
+    }
+    return fit;
+}
+
+/**
+ * @brief goal所在组中goal之后第一个能容纳want的段，没有时绕回组首找；
+ * 同一目录下的文件由此依次排在目录块之后
+ *
+ * @param goal
+ * @param want
+ * @return struct newfs_free_ext*
+ */
+static struct newfs_free_ext *space_near_fit(int64_t goal, int64_t want)
+{
+    int64_t g = NFS_DATA_GROUP(goal);
+    int64_t end = (g + 1) * newfs_super.data_per_group;
+    int first = ext_upper(g * newfs_super.data_per_group - 1);
+    int from = ext_upper(goal);
+    int idx;
+
+    for (idx = from; idx < newfs_space.nr_exts && newfs_space.exts[idx]->start < end; idx++)
+    {
+        if (newfs_space.exts[idx]->len >= want)
+        {
+            return newfs_space.exts[idx];
+        }
+    }
+    for (idx = first; idx < from; idx++)
+    {
+        if (newfs_space.exts[idx]->len >= want)
+        {
+            return newfs_space.exts[idx];
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * SECTION: 空闲空间接口
+ *******************************************************************************/
+/**
+ * @brief 挂载时由组描述符汇总空闲数，各组的空闲段在载入该组时才登记
+ */
+void newfs_space_build()
+{
+    int64_t g;
+
+    memset(&newfs_space, 0, sizeof(newfs_space));
+    for (g = 0; g < newfs_super.nr_groups; g++)
+    {
+        newfs_space.free_blks += newfs_super.gdt[g].free_blks;
+        newfs_space.free_inos += newfs_super.gdt[g].free_inos;
+    }
+    space_set_usage();
+}
+
+/**
+ * @brief 登记刚载入的第g组的空闲段，内存不足时撤销该组已登记的部分
+ *
+ * @param g
+ * @return int
+ */
+int newfs_space_load(int64_t g)
+{
+    const uint8_t *map = NFS_GROUP_DATA_MAP(&newfs_super.groups[g]);
+    int64_t base = g * newfs_super.data_per_group;
+    int64_t nbits = newfs_group_data_blks(g);
+    int64_t start, len;
+    int64_t from = 0;
+    int first = ext_upper(base);
+    int idx = first;
+
+    while ((start = newfs_bitmap_next_run(map, nbits, from, &len)) >= 0)
+    {
+        if (ext_insert_at(idx, base + start, len) != NFS_ERROR_NONE)
+        {
+            while (idx-- > first)
+            {
+                ext_remove_at(first);
+            }
+            return -NFS_ERROR_NOSPACE;
+        }
+        idx++;
+        from = start + len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 分配一段连续的数据块：goal处空闲时从goal起尽量向后延伸，
+ * 否则取goal所在组中其后第一个够长的段；组内放不下时在已载入的组中找能容纳want的
+ * 最短段(best-fit)，再找不到就从goal所在的组起依次载入描述符显示空闲足够的组；
+ * 都不够长时取最长的一段
+ *
+ * @param goal 期望的起点，小于0表示不限
+ * @param want 期望的长度
+ * @param len 返回实际分配的长度，不超过want
+ * @return int64_t 起点，没有空闲块时返回-1
+ */
+int64_t newfs_space_alloc(int64_t goal, int64_t want, int64_t *len)
+{
+    struct newfs_free_ext *fit = NULL;
+    struct newfs_free_ext *ext;
+    int64_t g0 = 0;
+    int64_t start, g, i;
+    int idx;
+
+    if (newfs_space.free_blks == 0)
+    {
+        return -1;
+    }
+    if (goal >= 0 && goal < newfs_super.data_blks)
+    {
+        g0 = NFS_DATA_GROUP(goal);
+        idx = newfs_group_get(g0) != NULL ? ext_upper(goal) - 1 : -1;
+        if (idx >= 0 && goal < newfs_space.exts[idx]->start + newfs_space.exts[idx]->len)
+        {
+            ext = newfs_space.exts[idx];
+            *len = ext->start + ext->len - goal < want ? ext->start + ext->len - goal : want;
+            return ext_carve(idx, goal, *len) == NFS_ERROR_NONE ? goal : -1;
+        }
+        fit = space_near_fit(goal, want);
+    }
+    if (fit == NULL)
+    {
+        fit = space_best_fit(want);
+    }
+    for (i = 0; i < newfs_super.nr_groups && fit == NULL; i++)
+    {
+        g = (g0 + i) % newfs_super.nr_groups;
+        if (newfs_super.groups[g].map == NULL && newfs_super.gdt[g].free_blks >= want &&
+            newfs_group_get(g) != NULL)
+        {
+            fit = space_best_fit(want);
+        }
+    }
+    if (fit == NULL)
+    {
+        /* 空间零碎，载入其余有空闲的组后取最长的一段 */
+        for (g = 0; g < newfs_super.nr_groups; g++)
+        {
+            if (newfs_super.gdt[g].free_blks > 0)
+            {
+                newfs_group_get(g);
+            }
+        }
+        fit = space_largest();
+    }
+    if (fit == NULL)
+    {
+        return -1;
+    }
+    start = fit->start;
+    *len = fit->len < want ? fit->len : want;
+    return ext_carve(ext_upper(start) - 1, start, *len) == NFS_ERROR_NONE ? start : -1;
+}
+
+/**
+ * @brief 释放一个数据块，与同组内前后相邻的空闲段合并
+ *
+ * @param dno
+ */
+void newfs_space_free(int64_t dno)
+{
+    int64_t g = dno / newfs_super.data_per_group;
+    struct newfs_group *grp = newfs_group_get(g);
+    struct newfs_free_ext *prev, *next;
+    int idx;
+
+    if (grp == NULL || !newfs_bitmap_test(NFS_GROUP_DATA_MAP(grp), dno % newfs_super.data_per_group))
+    {
+        return;
+    }
+    newfs_bitmap_clear(NFS_GROUP_DATA_MAP(grp), dno % newfs_super.data_per_group);
+    grp->dirty = TRUE;
+    newfs_super.gdt[g].free_blks++;
+    newfs_space.free_blks++;
+    space_set_usage();
+
+    /* 相邻的组在盘上隔着位图与inode表，不能合并 */
+    idx = ext_upper(dno);
+    prev = dno % newfs_super.data_per_group != 0 && idx > 0 &&
+                   newfs_space.exts[idx - 1]->start + newfs_space.exts[idx - 1]->len == dno
+               ? newfs_space.exts[idx - 1] : NULL;
+    next = (dno + 1) % newfs_super.data_per_group != 0 && idx < newfs_space.nr_exts &&
+                   newfs_space.exts[idx]->start == dno + 1
+               ? newfs_space.exts[idx] : NULL;
+    if (prev && next)
+    {
+        ext_resize(prev, prev->start, prev->len + 1 + next->len);
+        ext_remove_at(idx);
+    }
+    else if (prev)
+    {
+        ext_resize(prev, prev->start, prev->len + 1);
+    }
+    else if (next)
+    {
+        ext_resize(next, dno, next->len + 1);
+    }
+    else
+    {
+        /* 内存不足时该块只在位图中空闲，下次挂载重建索引后才能再分配 */
+        ext_insert_at(idx, dno, 1);
+    }
+}
+
+void newfs_space_destroy()
+{
+    free(newfs_space.exts);
+    newfs_slab_destroy(&newfs_extent_slab);
+    memset(&newfs_space, 0, sizeof(newfs_space));
+}
@@ -0,0 +1,850 @@
+#include "newfs.h"
+
+extern struct newfs_volume newfs_volume;
+extern struct newfs_tier newfs_tier;
+
+/******************************************************************************
+ * SECTION: 内部函数
+ *******************************************************************************/
+#define TIER_PINNED_SZ() (newfs_tier.pin_len + newfs_tier.nr_grps * newfs_tier.grp_pin)
+#define TIER_SLOT_OFS(slot) (newfs_tier.slot_off + (int64_t)(slot) * newfs_tier.blk_sz)
+#define TIER_MAP_PER_UNIT() (newfs_volume.sz_io / (int)sizeof(int64_t))
+
+/**
+ * @brief 快层同步读写
+ *
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param offset 快层内偏移
+ * @param buf
+ * @param size
+ * @return int
+ */
+static int fast_rw(int op, int64_t offset, uint8_t *buf, int size)
+{
+    int ret = op == DDRIVER_OP_READ
+                  ? ddriver_pread(newfs_tier.fd, (char *)buf, size, offset)
+                  : ddriver_pwrite(newfs_tier.fd, (char *)buf, size, offset);
+    return ret < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 卷内偏移是否落在固定到快层的元数据上：超级块与组描述符表，
+ * 或某组开头的位图与inode表
+ *
+ * @param offset
+ * @return int64_t 到所在固定区末尾的字节数，不在固定区时为0
+ */
+static int64_t tier_pinned(int64_t offset)
+{
+    int64_t grp, bias;
+
+    if (offset < newfs_tier.pin_len)
+    {
+        return newfs_tier.pin_len - offset;
+    }
+    if (newfs_tier.nr_grps == 0)
+    {
+        return 0;
+    }
+    grp = (offset - newfs_tier.pin_len) / newfs_tier.grp_len;
+    bias = (offset - newfs_tier.pin_len) % newfs_tier.grp_len;
+    return grp < newfs_tier.nr_grps && bias < newfs_tier.grp_pin ? newfs_tier.grp_pin - bias : 0;
+}
+
+/**
+ * @brief 固定区内的卷内偏移在快层上的位置，各固定区紧挨着排在分层头之后
+ *
+ * @param offset tier_pinned不为0的偏移
+ * @return int64_t
+ */
+static int64_t tier_pin_ofs(int64_t offset)
+{
+    int64_t grp;
+
+    if (offset < newfs_tier.pin_len)
+    {
+        return newfs_volume.sz_io + offset;
+    }
+    grp = (offset - newfs_tier.pin_len) / newfs_tier.grp_len;
+    return newfs_volume.sz_io + newfs_tier.pin_len + grp * newfs_tier.grp_pin +
+           (offset - newfs_tier.pin_len) % newfs_tier.grp_len;
+}
+
+/**
+ * @brief 慢层上累积的一段连续读写，遇到落在快层的块时先下发
+ *
+ * @param op
+ * @param offset
+ * @param buf
+ * @param len 下发后清零
+ * @return int
+ */
+static int slow_flush(int op, int64_t offset, uint8_t *buf, int *len)
+{
+    int ret = NFS_ERROR_NONE;
+
+    if (*len > 0)
+    {
+        ret = op == DDRIVER_OP_READ ? newfs_vol_pread(offset, buf, *len) : newfs_vol_pwrite(offset, buf, *len);
+        *len = 0;
+    }
+    return ret;
+}
+
+/**
+ * @brief 按布局参数确定快层各区的位置并分配内存中的索引：
+ * 分层头 | 固定的元数据 | 槽位表 | 槽位
+ *
+ * @param hdr 固定区与槽位的参数
+ * @return int
+ */
+static int tier_layout(const struct newfs_tier_hdr *hdr)
+{
+    int blk_sz = hdr->blk_sz;
+    int nr_slots = (int)hdr->nr_slots;
+    int64_t i;
+
+    newfs_tier.pin_len = hdr->pin_len;
+    newfs_tier.grp_len = hdr->grp_len;
+    newfs_tier.grp_pin = hdr->grp_pin;
+    newfs_tier.nr_grps = hdr->nr_grps;
+    newfs_tier.blk_sz = blk_sz;
+    newfs_tier.nr_slots = nr_slots;
+    newfs_tier.nr_blks = newfs_volume.size / blk_sz;
+    newfs_tier.map_off = newfs_volume.sz_io + TIER_PINNED_SZ();
+    newfs_tier.slot_off = newfs_tier.map_off +
+                          NFS_ROUND_UP((int64_t)nr_slots * (int64_t)sizeof(int64_t), newfs_volume.sz_io);
+    newfs_tier.slot_blk = (int64_t *)malloc(nr_slots * sizeof(int64_t));
+    newfs_tier.slot_dirty = (boolean *)calloc(nr_slots, sizeof(boolean));
+    newfs_tier.blk_slot = (int *)malloc(newfs_tier.nr_blks * sizeof(int));
+    newfs_tier.heat = (uint8_t *)calloc(newfs_tier.nr_blks, sizeof(uint8_t));
+    newfs_tier.blk_buf = (uint8_t *)malloc(blk_sz + newfs_volume.sz_io);
+    if (!newfs_tier.slot_blk || !newfs_tier.slot_dirty || !newfs_tier.blk_slot ||
+        !newfs_tier.heat || !newfs_tier.blk_buf)
+    {
+        newfs_tier.blk_sz = 0;
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < nr_slots; i++)
+    {
+        newfs_tier.slot_blk[i] = -1;
+    }
+    for (i = 0; i < newfs_tier.nr_blks; i++)
+    {
+        newfs_tier.blk_slot[i] = -1;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写回槽位表中包含该槽位的IO单元，槽位的归属一变即落盘，
+ * 崩溃后快层上的块不会被当作空闲
+ *
+ * @param slot
+ * @return int
+ */
+static int tier_map_store(int slot)
+{
+    int64_t *unit = (int64_t *)(newfs_tier.blk_buf + newfs_tier.blk_sz);
+    int first = slot / TIER_MAP_PER_UNIT() * TIER_MAP_PER_UNIT();
+    int i;
+
+    for (i = 0; i < TIER_MAP_PER_UNIT(); i++)
+    {
+        unit[i] = first + i < newfs_tier.nr_slots ? newfs_tier.slot_blk[first + i] : -1;
+    }
+    return fast_rw(DDRIVER_OP_WRITE, newfs_tier.map_off + (int64_t)first * sizeof(int64_t),
+                   (uint8_t *)unit, newfs_volume.sz_io);
+}
+
+/**
+ * @brief 记一次访问，每访问nr_blks次所有块的热度减半，只反映近期的访问
+ *
+ * @param blk
+ */
+static void tier_touch(int64_t blk)
+{
+    int64_t i;
+
+    if (newfs_tier.heat[blk] < NFS_TIER_HEAT_MAX)
+    {
+        newfs_tier.heat[blk]++;
+    }
+    if (++newfs_tier.touches >= newfs_tier.nr_blks)
+    {
+        for (i = 0; i < newfs_tier.nr_blks; i++)
+        {
+            newfs_tier.heat[i] >>= 1;
+        }
+        newfs_tier.touches = 0;
+    }
+}
+
+/**
+ * @brief 为待提升的块找一个槽位：时钟指针扫过各槽位，取空闲的或比它冷的，
+ * 扫过的槽位降温，长期不被访问的块终会让出槽位
+ *
+ * @param blk
+ * @return int 槽位，快层里的块都更热时返回-1
+ */
+static int tier_victim(int64_t blk)
+{
+    int64_t owner;
+    int slot, i;
+
+    for (i = 0; i < newfs_tier.nr_slots; i++)
+    {
+        slot = newfs_tier.hand;
+        newfs_tier.hand = (newfs_tier.hand + 1) % newfs_tier.nr_slots;
+        owner = newfs_tier.slot_blk[slot];
+        if (owner < 0 || newfs_tier.heat[owner] < newfs_tier.heat[blk])
+        {
+            return slot;
+        }
+        newfs_tier.heat[owner]--;
+    }
+    return -1;
+}
+
+/**
+ * @brief 将blk_buf中的整块内容放入槽位，原占用者比慢层新时先写回
+ *
+ * @param blk
+ * @param slot tier_victim的结果
+ * @param dirty 内容来自写入，慢层上的尚未更新
+ * @return int
+ */
+static int tier_promote(int64_t blk, int slot, boolean dirty)
+{
+    int64_t owner = newfs_tier.slot_blk[slot];
+    uint8_t *victim;
+    int ret = NFS_ERROR_NONE;
+
+    /* blk_buf里是新内容，写回的旧块另行暂存 */
+    if (owner >= 0 && newfs_tier.slot_dirty[slot])
+    {
+        victim = (uint8_t *)malloc(newfs_tier.blk_sz);
+        ret = victim == NULL ? -NFS_ERROR_NOSPACE
+                             : fast_rw(DDRIVER_OP_READ, TIER_SLOT_OFS(slot), victim, newfs_tier.blk_sz);
+        if (ret == NFS_ERROR_NONE)
+        {
+            ret = newfs_vol_pwrite(owner * newfs_tier.blk_sz, victim, newfs_tier.blk_sz);
+        }
+        free(victim);
+        if (ret != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        newfs_tier.writeback_cnt++;
+    }
+    if (owner >= 0)
+    {
+        newfs_tier.blk_slot[owner] = -1;
+        newfs_tier.demote_cnt++;
+    }
+    newfs_tier.slot_blk[slot] = blk;
+    newfs_tier.slot_dirty[slot] = dirty;
+    newfs_tier.blk_slot[blk] = slot;
+    newfs_tier.promote_cnt++;
+    if (fast_rw(DDRIVER_OP_WRITE, TIER_SLOT_OFS(slot), newfs_tier.blk_buf, newfs_tier.blk_sz) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    return tier_map_store(slot);
+}
+
+/**
+ * @brief 卷内一段不跨越块、也不跨越固定区边界的长度，固定区都按块对齐
+ *
+ * @param offset
+ * @param size
+ * @return int
+ */
+static int tier_chunk(int64_t offset, int size)
+{
+    int64_t left = tier_pinned(offset);
+
+    if (left == 0)
+    {
+        left = newfs_tier.blk_sz - offset % newfs_tier.blk_sz;
+    }
+    return left < size ? left : size;
+}
+
+/**
+ * @brief 块是否应从慢层提升，只看热度，不计本次访问
+ *
+ * @param blk
+ * @return boolean
+ */
+static boolean tier_is_hot(int64_t blk)
+{
+    return newfs_tier.heat[blk] + 1 >= NFS_TIER_HOT;
+}
+
+/******************************************************************************
+ * SECTION: 分层接口
+ *******************************************************************************/
+/**
+ * @brief 打开慢层卷，指定了快层时一并打开，快层上已有分层时载入槽位表
+ *
+ * @param options
+ * @return int
+ */
+int newfs_tier_open(struct custom_options options)
+{
+    struct newfs_tier_hdr hdr;
+    uint8_t *unit;
+    int backend = DDRIVER_BACKEND_MMAP;
+    int sz_io = 0;
+    int64_t i;
+    int ret;
+
+    memset(&newfs_tier, 0, sizeof(struct newfs_tier));
+    pthread_mutex_init(&newfs_tier.lock, NULL);
+    newfs_tier.fd = -1;
+    ret = newfs_vol_open(options);
+    if (ret != NFS_ERROR_NONE || options.fast == NULL)
+    {
+        return ret;
+    }
+
+    newfs_tier.path = strdup(options.fast);
+    newfs_tier.fd = ddriver_open(newfs_tier.path);
+    if (newfs_tier.fd < 0)
+    {
+        NFS_DBG("[%s] open fast tier %s failed\n", __func__, options.fast);
+        newfs_tier_close();
+        return -NFS_ERROR_IO;
+    }
+    if (options.mmap && ddriver_ioctl(newfs_tier.fd, IOC_REQ_DEVICE_BACKEND, &backend) != 0)
+    {
+        NFS_DBG("[%s] mmap backend unavailable on %s, use file backend\n", __func__, options.fast);
+    }
+    ddriver_ioctl(newfs_tier.fd, IOC_REQ_DEVICE_IO_SZ, &sz_io);
+    if (sz_io != newfs_volume.sz_io || ddriver_ioctl(newfs_tier.fd, IOC_REQ_DEVICE_SIZE64, &newfs_tier.size) != 0)
+    {
+        NFS_DBG("[%s] fast tier io size %d differs from %d\n", __func__, sz_io, newfs_volume.sz_io);
+        newfs_tier_close();
+        return -NFS_ERROR_INVAL;
+    }
+
+    unit = (uint8_t *)malloc(newfs_volume.sz_io);
+    if (unit == NULL || fast_rw(DDRIVER_OP_READ, 0, unit, newfs_volume.sz_io) != NFS_ERROR_NONE)
+    {
+        free(unit);
+        newfs_tier_close();
+        return -NFS_ERROR_IO;
+    }
+    memcpy(&hdr, unit, sizeof(hdr));
+    free(unit);
+    /* 空白的快层等挂载确定元数据范围后再建立分层 */
+    if (hdr.magic != NFS_TIER_MAGIC)
+    {
+        return NFS_ERROR_NONE;
+    }
+    if (hdr.vol_size != newfs_volume.size)
+    {
+        NFS_DBG("[%s] fast tier belongs to a %ld volume, got %ld\n", __func__,
+                (long)hdr.vol_size, (long)newfs_volume.size);
+        newfs_tier_close();
+        return -NFS_ERROR_INVAL;
+    }
+    ret = tier_layout(&hdr);
+    for (i = 0; i < newfs_tier.nr_slots && ret == NFS_ERROR_NONE; i += TIER_MAP_PER_UNIT())
+    {
+        ret = fast_rw(DDRIVER_OP_READ, newfs_tier.map_off + i * sizeof(int64_t),
+                      newfs_tier.blk_buf, newfs_volume.sz_io);
+        memcpy(newfs_tier.slot_blk + i, newfs_tier.blk_buf,
+               (newfs_tier.nr_slots - i < TIER_MAP_PER_UNIT() ? newfs_tier.nr_slots - i : TIER_MAP_PER_UNIT()) *
+                   sizeof(int64_t));
+    }
+    /* 不知道槽位上次是否写回过，一律按比慢层新处理 */
+    for (i = 0; i < newfs_tier.nr_slots && ret == NFS_ERROR_NONE; i++)
+    {
+        if (newfs_tier.slot_blk[i] < 0 || newfs_tier.slot_blk[i] >= newfs_tier.nr_blks)
+        {
+            newfs_tier.slot_blk[i] = -1;
+            continue;
+        }
+        newfs_tier.blk_slot[newfs_tier.slot_blk[i]] = i;
+        newfs_tier.slot_dirty[i] = TRUE;
+    }
+    if (ret != NFS_ERROR_NONE)
+    {
+        newfs_tier_close();
+    }
+    return ret;
+}
+
+/**
+ * @brief 建立分层：卷开头的超级块与组描述符表、各组的位图与inode表固定到快层，
+ * 其余空间划为热块槽位；已建立的分层只核对参数。未指定快层时什么也不做
+ *
+ * @param pin_len 卷开头元数据的字节数，即首组的起点
+ * @param grp_len 每组的字节数
+ * @param grp_pin 每组开头元数据的字节数
+ * @param nr_grps
+ * @param blk_sz 迁移粒度，各长度都是它的整数倍
+ * @return int
+ */
+int newfs_tier_attach(int64_t pin_len, int64_t grp_len, int64_t grp_pin, int64_t nr_grps, int blk_sz)
+{
+    struct newfs_tier_hdr layout;
+    struct newfs_tier_hdr *hdr;
+    int64_t avail, offset;
+    int nr_slots, i;
+    int ret;
+
+    if (newfs_tier.fd < 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+    if (newfs_tier.blk_sz != 0)
+    {
+        if (newfs_tier.pin_len != pin_len || newfs_tier.grp_len != grp_len || newfs_tier.grp_pin != grp_pin ||
+            newfs_tier.nr_grps != nr_grps || newfs_tier.blk_sz != blk_sz)
+        {
+            NFS_DBG("[%s] fast tier pins %ld + %ld x %ld in %d blocks, fs wants %ld + %ld x %ld in %d\n", __func__,
+                    (long)newfs_tier.pin_len, (long)newfs_tier.nr_grps, (long)newfs_tier.grp_pin, newfs_tier.blk_sz,
+                    (long)pin_len, (long)nr_grps, (long)grp_pin, blk_sz);
+            return -NFS_ERROR_INVAL;
+        }
+        return NFS_ERROR_NONE;
+    }
+
+    avail = newfs_tier.size - newfs_volume.sz_io - pin_len - nr_grps * grp_pin;
+    nr_slots = avail > 0 ? avail / (blk_sz + (int)sizeof(int64_t)) : 0;
+    while (nr_slots > 0 && NFS_ROUND_UP((int64_t)nr_slots * (int64_t)sizeof(int64_t), newfs_volume.sz_io) +
+                                   (int64_t)nr_slots * blk_sz > avail)
+    {
+        nr_slots--;
+    }
+    if (nr_slots == 0)
+    {
+        NFS_DBG("[%s] fast tier %ld too small for %ld metadata\n", __func__,
+                (long)newfs_tier.size, (long)(pin_len + nr_grps * grp_pin));
+        return -NFS_ERROR_NOSPACE;
+    }
+    memset(&layout, 0, sizeof(layout));
+    layout.magic = NFS_TIER_MAGIC;
+    layout.blk_sz = blk_sz;
+    layout.pin_len = pin_len;
+    layout.grp_len = grp_len;
+    layout.grp_pin = grp_pin;
+    layout.nr_grps = nr_grps;
+    layout.nr_slots = nr_slots;
+    layout.vol_size = newfs_volume.size;
+    ret = tier_layout(&layout);
+    if (ret != NFS_ERROR_NONE)
+    {
+        return ret;
+    }
+
+    /* 已有的文件系统后加快层时，元数据从慢层搬过来 */
+    for (offset = 0; offset < pin_len + nr_grps * grp_len && ret == NFS_ERROR_NONE; offset += blk_sz)
+    {
+        if (tier_pinned(offset) == 0)
+        {
+            continue;
+        }
+        ret = newfs_vol_pread(offset, newfs_tier.blk_buf, blk_sz);
+        if (ret == NFS_ERROR_NONE)
+        {
+            ret = fast_rw(DDRIVER_OP_WRITE, tier_pin_ofs(offset), newfs_tier.blk_buf, blk_sz);
+        }
+    }
+    for (i = 0; i < nr_slots && ret == NFS_ERROR_NONE; i += TIER_MAP_PER_UNIT())
+    {
+        ret = tier_map_store(i);
+    }
+    if (ret != NFS_ERROR_NONE)
+    {
+        newfs_tier.blk_sz = 0;
+        return -NFS_ERROR_IO;
+    }
+
+    memset(newfs_tier.blk_buf, 0, newfs_volume.sz_io);
+    hdr = (struct newfs_tier_hdr *)newfs_tier.blk_buf;
+    *hdr = layout;
+    return fast_rw(DDRIVER_OP_WRITE, 0, newfs_tier.blk_buf, newfs_volume.sz_io);
+}
+
+/**
+ * @brief 读：元数据与已提升的块读快层，其余读慢层，连续的慢层块合为一次；
+ * 读到变热的块时整块搬进快层
+ *
+ * @param offset 按IO单元对齐
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+int newfs_tier_pread(int64_t offset, uint8_t *buf, int size)
+{
+    int64_t run_off = offset;
+    uint8_t *run_buf = buf;
+    int run_len = 0;
+    int64_t blk;
+    int slot, bias, len;
+    boolean pinned;
+    int ret = NFS_ERROR_NONE;
+
+    if (newfs_tier.blk_sz == 0)
+    {
+        return newfs_vol_pread(offset, buf, size);
+    }
+    pthread_mutex_lock(&newfs_tier.lock);
+    while (size > 0 && ret == NFS_ERROR_NONE)
+    {
+        len = tier_chunk(offset, size);
+        blk = offset / newfs_tier.blk_sz;
+        bias = offset % newfs_tier.blk_sz;
+        pinned = tier_pinned(offset) != 0;
+        if (!pinned && blk < newfs_tier.nr_blks)
+        {
+            tier_touch(blk);
+        }
+        if (pinned)
+        {
+            ret = slow_flush(DDRIVER_OP_READ, run_off, run_buf, &run_len);
+            if (ret == NFS_ERROR_NONE)
+            {
+                ret = fast_rw(DDRIVER_OP_READ, tier_pin_ofs(offset), buf, len);
+            }
+            newfs_tier.pin_cnt++;
+        }
+        else if (blk < newfs_tier.nr_blks && (slot = newfs_tier.blk_slot[blk]) >= 0)
+        {
+            ret = slow_flush(DDRIVER_OP_READ, run_off, run_buf, &run_len);
+            if (ret == NFS_ERROR_NONE)
+            {
+                ret = fast_rw(DDRIVER_OP_READ, TIER_SLOT_OFS(slot) + bias, buf, len);
+            }
+            newfs_tier.fast_cnt++;
+        }
+        else if (blk < newfs_tier.nr_blks && newfs_tier.heat[blk] >= NFS_TIER_HOT &&
+                 (slot = tier_victim(blk)) >= 0)
+        {
+            ret = slow_flush(DDRIVER_OP_READ, run_off, run_buf, &run_len);
+            if (ret == NFS_ERROR_NONE)
+            {
+                ret = newfs_vol_pread(blk * newfs_tier.blk_sz, newfs_tier.blk_buf, newfs_tier.blk_sz);
+            }
+            if (ret == NFS_ERROR_NONE)
+            {
+                memcpy(buf, newfs_tier.blk_buf + bias, len);
+                ret = tier_promote(blk, slot, FALSE);
+            }
+            newfs_tier.slow_cnt++;
+        }
+        else
+        {
+            if (run_len == 0)
+            {
+                run_off = offset;
+                run_buf = buf;
+            }
+            run_len += len;
+            newfs_tier.slow_cnt++;
+        }
+        offset += len;
+        buf += len;
+        size -= len;
+    }
+    if (ret == NFS_ERROR_NONE)
+    {
+        ret = slow_flush(DDRIVER_OP_READ, run_off, run_buf, &run_len);
+    }
+    pthread_mutex_unlock(&newfs_tier.lock);
+    return ret;
+}
+
+/**
+ * @brief 写：元数据与已提升的块写快层，变热的块写入时直接放进快层，
+ * 其余写慢层。超级块同时写到慢层，不带快层挂载时能认出这是分层卷
+ *
+ * @param offset 按IO单元对齐
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+int newfs_tier_pwrite(int64_t offset, uint8_t *buf, int size)
+{
+    int64_t run_off = offset;
+    uint8_t *run_buf = buf;
+    int run_len = 0;
+    int64_t blk;
+    int slot, bias, len;
+    boolean pinned;
+    int ret = NFS_ERROR_NONE;
+
+    if (newfs_tier.blk_sz == 0)
+    {
+        return newfs_vol_pwrite(offset, buf, size);
+    }
+    pthread_mutex_lock(&newfs_tier.lock);
+    while (size > 0 && ret == NFS_ERROR_NONE)
+    {
+        len = tier_chunk(offset, size);
+        blk = offset / newfs_tier.blk_sz;
+        bias = offset % newfs_tier.blk_sz;
+        pinned = tier_pinned(offset) != 0;
+        if (!pinned && blk < newfs_tier.nr_blks)
+        {
+            tier_touch(blk);
+        }
+        if (pinned)
+        {
+            ret = slow_flush(DDRIVER_OP_WRITE, run_off, run_buf, &run_len);
+            if (ret == NFS_ERROR_NONE)
+            {
+                ret = fast_rw(DDRIVER_OP_WRITE, tier_pin_ofs(offset), buf, len);
+            }
+            if (ret == NFS_ERROR_NONE && offset < newfs_tier.blk_sz)
+            {
+                ret = newfs_vol_pwrite(offset, buf, newfs_tier.blk_sz - offset < len ? newfs_tier.blk_sz - offset : len);
+            }
+            newfs_tier.pin_cnt++;
+        }
+        else if (blk < newfs_tier.nr_blks && (slot = newfs_tier.blk_slot[blk]) >= 0)
+        {
+            ret = slow_flush(DDRIVER_OP_WRITE, run_off, run_buf, &run_len);
+            if (ret == NFS_ERROR_NONE)
+            {
+                ret = fast_rw(DDRIVER_OP_WRITE, TIER_SLOT_OFS(slot) + bias, buf, len);
+            }
+            newfs_tier.slot_dirty[slot] = TRUE;
+            newfs_tier.fast_cnt++;
+        }
+        else if (blk < newfs_tier.nr_blks && newfs_tier.heat[blk] >= NFS_TIER_HOT &&
+                 (slot = tier_victim(blk)) >= 0)
+        {
+            ret = slow_flush(DDRIVER_OP_WRITE, run_off, run_buf, &run_len);
+            /* 整块覆盖时无需读出慢层上的旧内容 */
+            if (ret == NFS_ERROR_NONE && len != newfs_tier.blk_sz)
+            {
+                ret = newfs_vol_pread(blk * newfs_tier.blk_sz, newfs_tier.blk_buf, newfs_tier.blk_sz);
+            }
+            if (ret == NFS_ERROR_NONE)
+            {
+                memcpy(newfs_tier.blk_buf + bias, buf, len);
+                ret = tier_promote(blk, slot, TRUE);
+            }
+            newfs_tier.fast_cnt++;
+        }
+        else
+        {
+            if (run_len == 0)
+            {
+                run_off = offset;
+                run_buf = buf;
+            }
+            run_len += len;
+            newfs_tier.slow_cnt++;
+        }
+        offset += len;
+        buf += len;
+        size -= len;
+    }
+    if (ret == NFS_ERROR_NONE)
+    {
+        ret = slow_flush(DDRIVER_OP_WRITE, run_off, run_buf, &run_len);
+    }
+    pthread_mutex_unlock(&newfs_tier.lock);
+    return ret;
+}
+
+/**
+ * @brief 供调度器判断一段写能否按原偏移异步下发到慢层卷：
+ * 从offset起连续的、既不在快层也不会被提升的块计入热度后算作一段
+ *
+ * @param offset
+ * @param size
+ * @param len 返回这一段的长度；返回FALSE时为须经newfs_tier_pwrite同步写入的长度
+ * @return boolean
+ */
+boolean newfs_tier_map_write(int64_t offset, int size, int *len)
+{
+    int64_t cursor, blk;
+    int chunk;
+
+    if (newfs_tier.blk_sz == 0)
+    {
+        *len = size;
+        return TRUE;
+    }
+    pthread_mutex_lock(&newfs_tier.lock);
+    for (*len = 0; *len < size; *len += chunk)
+    {
+        cursor = offset + *len;
+        chunk = tier_chunk(cursor, size - *len);
+        blk = cursor / newfs_tier.blk_sz;
+        if (tier_pinned(cursor) != 0 ||
+            (blk < newfs_tier.nr_blks && (newfs_tier.blk_slot[blk] >= 0 || tier_is_hot(blk))))
+        {
+            break;
+        }
+        if (blk < newfs_tier.nr_blks)
+        {
+            tier_touch(blk);
+        }
+        newfs_tier.slow_cnt++;
+    }
+    if (*len == 0)
+    {
+        *len = tier_chunk(offset, size);
+        pthread_mutex_unlock(&newfs_tier.lock);
+        return FALSE;
+    }
+    pthread_mutex_unlock(&newfs_tier.lock);
+    return TRUE;
+}
+
+/**
+ * @brief 获取一段区间在设备映射中的地址：整段在固定区内、在同一个快层槽位内，
+ * 或全部是不会被提升的慢层块时才可映射，否则返回NULL，调用者退回普通读写。
+ * 超级块须同时写到慢层，不提供写映射
+ *
+ * @param offset 按IO单元对齐
+ * @param size IO单元的整数倍
+ * @param flags DDRIVER_MAP_READ / DDRIVER_MAP_WRITE
+ * @return char*
+ */
+char *newfs_tier_map_block(int64_t offset, int size, int flags)
+{
+    int64_t first, last, blk;
+    char *mapped = NULL;
+    int slot;
+
+    if (newfs_tier.blk_sz == 0)
+    {
+        return newfs_vol_map_block(offset, size, flags);
+    }
+    pthread_mutex_lock(&newfs_tier.lock);
+    first = offset / newfs_tier.blk_sz;
+    last = (offset + size - 1) / newfs_tier.blk_sz;
+    if (tier_pinned(offset) >= size)
+    {
+        if (!((flags & DDRIVER_MAP_WRITE) && offset < newfs_tier.blk_sz))
+        {
+            newfs_tier.pin_cnt++;
+            mapped = ddriver_map_block(newfs_tier.fd, tier_pin_ofs(offset), size, flags);
+        }
+    }
+    else if (tier_pinned(offset) == 0 && first == last && first < newfs_tier.nr_blks &&
+             (slot = newfs_tier.blk_slot[first]) >= 0)
+    {
+        mapped = ddriver_map_block(newfs_tier.fd, TIER_SLOT_OFS(slot) + offset % newfs_tier.blk_sz, size, flags);
+        if (mapped != NULL)
+        {
+            tier_touch(first);
+            newfs_tier.slot_dirty[slot] |= (flags & DDRIVER_MAP_WRITE) != 0;
+            newfs_tier.fast_cnt++;
+        }
+    }
+    else if (tier_pinned(offset) == 0)
+    {
+        for (blk = first; blk <= last && blk < newfs_tier.nr_blks; blk++)
+        {
+            if (tier_pinned(blk * newfs_tier.blk_sz) != 0 || newfs_tier.blk_slot[blk] >= 0 || tier_is_hot(blk))
+            {
+                break;
+            }
+        }
+        if (blk > last || blk >= newfs_tier.nr_blks)
+        {
+            mapped = newfs_vol_map_block(offset, size, flags);
+        }
+        for (blk = first; mapped != NULL && blk <= last && blk < newfs_tier.nr_blks; blk++)
+        {
+            tier_touch(blk);
+            newfs_tier.slow_cnt++;
+        }
+    }
+    pthread_mutex_unlock(&newfs_tier.lock);
+    return mapped;
+}
+
+/**
+ * @brief 丢弃一段被释放的数据块，快层上的副本直接作废，不再写回
+ *
+ * @param offset 按块对齐
+ * @param len 块大小的整数倍
+ * @return int
+ */
+int newfs_tier_discard(int64_t offset, int64_t len)
+{
+    int64_t blk;
+    int slot;
+    int ret = NFS_ERROR_NONE;
+
+    if (newfs_tier.blk_sz != 0 && tier_pinned(offset) == 0)
+    {
+        pthread_mutex_lock(&newfs_tier.lock);
+        for (blk = offset / newfs_tier.blk_sz;
+             blk < (offset + len) / newfs_tier.blk_sz && blk < newfs_tier.nr_blks; blk++)
+        {
+            newfs_tier.heat[blk] = 0;
+            slot = newfs_tier.blk_slot[blk];
+            if (slot < 0)
+            {
+                continue;
+            }
+            newfs_tier.blk_slot[blk] = -1;
+            newfs_tier.slot_blk[slot] = -1;
+            newfs_tier.slot_dirty[slot] = FALSE;
+            if (tier_map_store(slot) != NFS_ERROR_NONE)
+            {
+                ret = -NFS_ERROR_IO;
+            }
+        }
+        pthread_mutex_unlock(&newfs_tier.lock);
+    }
+    if (newfs_vol_discard(offset, len) != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    return ret;
+}
+
+/**
+ * @brief 持久化慢层卷与快层
+ *
+ * @return int
+ */
+int newfs_tier_sync()
+{
+    int ret = newfs_vol_sync();
+
+    if (newfs_tier.fd >= 0 && ddriver_sync(newfs_tier.fd) < 0)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    return ret;
+}
+
+/**
+ * @brief 关闭快层与慢层卷，槽位表已随每次变动落盘
+ */
+void newfs_tier_close()
+{
+    if (newfs_tier.fd >= 0)
+    {
+        ddriver_close(newfs_tier.fd);
+    }
+    free(newfs_tier.path);
+    free(newfs_tier.slot_blk);
+    free(newfs_tier.slot_dirty);
+    free(newfs_tier.blk_slot);
+    free(newfs_tier.heat);
+    free(newfs_tier.blk_buf);
+    newfs_tier.path = NULL;
+    newfs_tier.slot_blk = NULL;
+    newfs_tier.slot_dirty = NULL;
+    newfs_tier.blk_slot = NULL;
+    newfs_tier.heat = NULL;
+    newfs_tier.blk_buf = NULL;
+    newfs_tier.fd = -1;
+    newfs_tier.blk_sz = 0;
+    newfs_vol_close();
+}
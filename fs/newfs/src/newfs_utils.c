@@ -1,99 +1,301 @@
 extern struct newfs_super newfs_super;
 extern struct custom_options newfs_options;
+extern struct newfs_cache newfs_cache;
+extern struct newfs_sched newfs_sched;
+extern struct newfs_volume newfs_volume;
+extern struct newfs_tier newfs_tier;
+extern struct newfs_space newfs_space;
+extern struct newfs_slab newfs_dentry_slab;
+extern struct newfs_slab newfs_inode_slab;
 #include "newfs.h"
 
 /**
- * @brief 驱动读
+ * @brief 驱动读，开启块缓存时经由缓存
  *
  * @param offset
  * @param out_content
  * @param size
  * @return int
  */
-int newfs_driver_read(int offset, uint8_t *out_content, int size)
+int newfs_driver_read(int64_t offset, uint8_t *out_content, int size)
 {
-    int offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
+    if (newfs_cache.nr_bufs > 0)
+    {
+        return newfs_cache_read(offset, out_content, size);
+    }
+    return newfs_dev_read(offset, out_content, size);
+}
+
+/**
+ * @brief 驱动写，开启块缓存时经由缓存
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int newfs_driver_write(int64_t offset, uint8_t *in_content, int size)
+{
+    if (newfs_cache.nr_bufs > 0)
+    {
+        return newfs_cache_write(offset, in_content, size);
+    }
+    return newfs_dev_write(offset, in_content, size);
+}
+
+/**
+ * @brief 读取一段元数据，条件允许时直接返回设备映射中的地址
+ *
+ * 仅在MMAP后端且未开启块缓存时原地返回，否则读入fallback；
+ * 返回的内容只读，且只在下一次写设备前有效
+ *
+ * @param offset
+ * @param size
+ * @param fallback 至少size字节
+ * @return const uint8_t* 失败返回NULL
+ */
+const uint8_t *newfs_driver_peek(int64_t offset, int size, uint8_t *fallback)
+{
+    int64_t offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
+    int size_aligned = NFS_ROUND_UP((size + offset - offset_aligned), NFS_IO_SZ());
+    char *mapped;
+
+    if (newfs_cache.nr_bufs == 0)
+    {
+        mapped = newfs_tier_map_block(offset_aligned, size_aligned, DDRIVER_MAP_READ);
+        if (mapped != NULL)
+        {
+            newfs_sched.head = offset_aligned + size_aligned;
+            return (const uint8_t *)mapped + (offset - offset_aligned);
+        }
+    }
+    if (newfs_driver_read(offset, fallback, size) != NFS_ERROR_NONE)
+    {
+        return NULL;
+    }
+    return fallback;
+}
+
+/**
+ * @brief 写回块缓存并持久化设备，MMAP后端下即msync
+ *
+ * @return int
+ */
+int newfs_driver_sync()
+{
+    if (newfs_cache_flush() != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    if (newfs_tier_sync() != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从对齐位置连续读入若干IO单元
+ *
+ * @param offset_aligned 按IO单元对齐的偏移
+ * @param buf
+ * @param unit_cnt IO单元个数
+ * @return int
+ */
+int newfs_dev_read_units(int64_t offset_aligned, uint8_t *buf, int unit_cnt)
+{
+    newfs_sched.head = offset_aligned + unit_cnt * NFS_IO_SZ();
+    return newfs_tier_pread(offset_aligned, buf, unit_cnt * NFS_IO_SZ());
+}
+
+/**
+ * @brief 从对齐位置连续写入若干IO单元
+ *
+ * @param offset_aligned 按IO单元对齐的偏移
+ * @param buf
+ * @param unit_cnt IO单元个数
+ * @return int
+ */
+int newfs_dev_write_units(int64_t offset_aligned, uint8_t *buf, int unit_cnt)
+{
+    newfs_sched.head = offset_aligned + unit_cnt * NFS_IO_SZ();
+    return newfs_tier_pwrite(offset_aligned, buf, unit_cnt * NFS_IO_SZ());
+}
+
+/**
+ * @brief 设备读，绕过块缓存直接访问卷
+ *
+ * @param offset
+ * @param out_content
+ * @param size
+ * @return int
+ */
+int newfs_dev_read(int64_t offset, uint8_t *out_content, int size)
+{
+    int64_t offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
     int bias = offset - offset_aligned;
     int size_aligned = NFS_ROUND_UP((size + bias), NFS_IO_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    uint8_t *temp_content;
+    char *mapped;
+
+    /* MMAP后端直接从映射拷出，无需暂存区 */
+    mapped = newfs_tier_map_block(offset_aligned, size_aligned, DDRIVER_MAP_READ);
+    if (mapped != NULL)
     {
-        ddriver_read(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();
+        newfs_sched.head = offset_aligned + size_aligned;
+        memcpy(out_content, mapped + bias, size);
+        return NFS_ERROR_NONE;
+    }
+
+    /* 对齐的请求直接读入调用者的缓冲区 */
+    if (bias == 0 && size_aligned == size)
+    {
+        return newfs_dev_read_units(offset_aligned, out_content, size_aligned / NFS_IO_SZ());
+    }
+
+    temp_content = newfs_scratch_get(size_aligned);
+    if (temp_content == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (newfs_dev_read_units(offset_aligned, temp_content,
+                             size_aligned / NFS_IO_SZ()) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
     }
     memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
     return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 驱动写
+ * @brief 设备写，绕过块缓存直接访问卷
  *
  * @param offset
  * @param in_content
  * @param size
  * @return int
  */
-int newfs_driver_write(int offset, uint8_t *in_content, int size)
+int newfs_dev_write(int64_t offset, uint8_t *in_content, int size)
 {
-    int offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
+    int64_t offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
     int bias = offset - offset_aligned;
     int size_aligned = NFS_ROUND_UP((size + bias), NFS_IO_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
+    int64_t tail = offset_aligned + size_aligned - NFS_IO_SZ(); /* 最后一个IO单元 */
+    uint8_t *temp_content;
+    char *mapped;
 
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    /* MMAP后端原地写入，首尾IO单元也无需先读后写 */
+    mapped = newfs_tier_map_block(offset_aligned, size_aligned, DDRIVER_MAP_WRITE);
+    if (mapped != NULL)
     {
-        ddriver_write(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();
+        newfs_sched.head = offset_aligned + size_aligned;
+        memcpy(mapped + bias, in_content, size);
+        return NFS_ERROR_NONE;
     }
 
-    free(temp_content);
-    return NFS_ERROR_NONE;
+    /* 对齐的请求直接从调用者的缓冲区写出 */
+    if (bias == 0 && size_aligned == size)
+    {
+        return newfs_dev_write_units(offset_aligned, in_content, size_aligned / NFS_IO_SZ());
+    }
+
+    temp_content = newfs_scratch_get(size_aligned);
+    if (temp_content == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    /* 只有首尾未被完整覆盖的IO单元需要先读后写；读不出旧内容时不能拿暂存区的残留去覆盖 */
+    if (bias != 0 && newfs_dev_read_units(offset_aligned, temp_content, 1) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    if ((offset + size) % NFS_IO_SZ() != 0 && (tail != offset_aligned || bias == 0) &&
+        newfs_dev_read_units(tail, temp_content + size_aligned - NFS_IO_SZ(), 1) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    memcpy(temp_content + bias, in_content, size);
+
+    return newfs_dev_write_units(offset_aligned, temp_content, size_aligned / NFS_IO_SZ());
 }
 
 /**
  * @brief 分配一个数据块，占用位图
+ * @param goal 期望的块号，小于0表示不限
  * @return 数据块的offset
  */
-int newfs_alloc_data_blk()
+int64_t newfs_alloc_data_blk(int64_t goal)
+{
+    int64_t len;
+    int64_t dno = newfs_space_alloc(goal, 1, &len);
+
+    if (dno < 0)
+        return -NFS_ERROR_NOSPACE;
+
+    return dno;
+}
+
+/**
+ * @brief 分配一段连续的数据块，goal处不空闲或空间零碎时可能短于want
+ *
+ * @param goal 期望的起始块号，小于0表示不限
+ * @param want 期望的块数
+ * @param len 返回实际分配的块数
+ * @return int64_t 起始块号
+ */
+int64_t newfs_alloc_data_extent(int64_t goal, int64_t want, int64_t *len)
+{
+    int64_t dno = newfs_space_alloc(goal, want, len);
+
+    if (dno < 0)
+        return -NFS_ERROR_NOSPACE;
+
+    return dno;
+}
+
+/**
+ * @brief 为inode新增的块选一个期望位置：已有块时紧接末块；新文件排在父目录的
+ * 目录块之后，ls与随后逐个读文件时少寻道；目录或父目录在别组时从本组数据区开头找
+ *
+ * @param inode
+ * @return int64_t 期望的块号
+ */
+static int64_t newfs_data_goal(struct newfs_inode *inode)
 {
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int data_cursor = 0;
-    boolean is_find_free_entry = FALSE;
+    struct newfs_inode *parent;
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.data_map_blks);
-         byte_cursor++)
+    if (inode->size > 0)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
-        {
-            if ((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0)
-            {
-                /* 当前ino_cursor位置空闲 */
-                newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;
-                break;
-            }
-            data_cursor++;
-        }
-        if (is_find_free_entry)
-        {
-            break;
-        }
+        return inode->block_pointer[inode->size - 1] + 1;
+    }
+    parent = inode->dentry->parent ? inode->dentry->parent->inode : NULL;
+    if (!NFS_IS_DIR(inode) && parent && parent->size > 0 &&
+        NFS_DATA_GROUP(parent->block_pointer[parent->size - 1]) == NFS_INO_GROUP(inode->ino))
+    {
+        return parent->block_pointer[parent->size - 1] + 1;
     }
+    return NFS_INO_GROUP(inode->ino) * newfs_super.data_per_group;
+}
 
-    if (!is_find_free_entry || data_cursor == newfs_super.data_blks) // TODO
-        return -NFS_ERROR_NOSPACE;
+/**
+ * @brief 从第from个数据块起物理上连续的块数，用于合并读写；
+ * 相邻组的数据块之间隔着下一组的位图与inode表
+ *
+ * @param inode
+ * @param from
+ * @return int
+ */
+static int newfs_blk_run(struct newfs_inode *inode, int from)
+{
+    int cnt = 1;
 
-    return data_cursor;
+    while (from + cnt < inode->size &&
+           inode->block_pointer[from + cnt] == inode->block_pointer[from + cnt - 1] + 1 &&
+           inode->block_pointer[from + cnt] % newfs_super.data_per_group != 0)
+    {
+        cnt++;
+    }
+    return cnt;
 }
 
 /**
@@ -105,39 +307,17 @@ int newfs_alloc_data_blk()
 struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry)
 {
     struct newfs_inode *inode;
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int ino_cursor = 0;
-    boolean is_find_free_entry = FALSE;
-
-    // 找到空闲的inode位图位置
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.ino_map_blks);
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
-        {
-            if ((newfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0)
-            {
-                /* 当前ino_cursor位置空闲 */
-                newfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry)
-        {
-            break;
-        }
-    }
+    int64_t ino_cursor;
 
-    if (!is_find_free_entry || ino_cursor == (INODE_PER_BLK * newfs_super.ino_blks)) // TODO
+    // 找到空闲的inode位图位置，先按父目录选组
+    ino_cursor = newfs_group_alloc_inode(newfs_group_find(dentry), dentry->ftype == NFS_DIR);
+    if (ino_cursor < 0)
         return NULL;
 
-    inode = (struct newfs_inode *)malloc(sizeof(struct newfs_inode));
+    inode = (struct newfs_inode *)newfs_slab_alloc(&newfs_inode_slab);
     inode->ino = ino_cursor;
     inode->size = 0;
-    memset(inode->block_pointer, 0, sizeof(int) * NFS_MAX_SIZE_PER_FILE);
+    memset(inode->block_pointer, 0, sizeof(int64_t) * NFS_MAX_SIZE_PER_FILE);
     /* dentry指向inode */
     dentry->inode = inode;
     dentry->ino = inode->ino;
@@ -165,10 +345,10 @@ int newfs_sync_inode(struct newfs_inode *inode)
     int ino = inode->ino;
     inode_d.ino = ino;
     inode_d.size = inode->size;
-    memcpy(inode_d.block_pointer, inode->block_pointer, sizeof(int) * NFS_MAX_SIZE_PER_FILE);
+    memcpy(inode_d.block_pointer, inode->block_pointer, sizeof(int64_t) * NFS_MAX_SIZE_PER_FILE);
     inode_d.ftype = inode->dentry->ftype;
     inode_d.dir_cnt = inode->dir_cnt;
-    int offset = 0;
+    int64_t offset = 0;
     int write_length = 0;
     int index = 0;
 
@@ -183,7 +363,8 @@ int newfs_sync_inode(struct newfs_inode *inode)
     dentry_cursor = inode->dentrys;
     if (NFS_IS_DIR(inode) && dentry_cursor != NULL)
     {
-        offset = NFS_DATA_OFS(inode->block_pointer[index++]);
+        offset = NFS_DATA_OFS(inode->block_pointer[index]);
+        index++;
         while (dentry_cursor != NULL)
         {
             assert(index - 1 < inode->size);
@@ -206,20 +387,24 @@ int newfs_sync_inode(struct newfs_inode *inode)
             dentry_cursor = dentry_cursor->brother;
             offset += sizeof(struct newfs_dentry_d);
             write_length += sizeof(struct newfs_dentry_d);
-            if (write_length + sizeof(struct newfs_dentry_d) > NFS_LOGIC_SZ())
+            /* 末块写满时后面已没有目录项，不再取下一个块指针 */
+            if (write_length + sizeof(struct newfs_dentry_d) > NFS_LOGIC_SZ() && dentry_cursor != NULL)
             {
                 write_length = 0;
-                offset = NFS_DATA_OFS(inode->block_pointer[index++]);
+                offset = NFS_DATA_OFS(inode->block_pointer[index]);
+                index++;
                 // printf("write into data blk %d\n", inode->block_pointer[index - 1]);
             }
         }
     }
     else if (NFS_IS_REG(inode))
     {
-        for (int i = 0; i < inode->size; i++)
+        /* 连续的数据块合为一次写 */
+        for (int i = 0, run; i < inode->size; i += run)
         {
+            run = newfs_blk_run(inode, i);
             if (newfs_driver_write(NFS_DATA_OFS(inode->block_pointer[i]), inode->data + i * NFS_LOGIC_SZ(),
-                                   NFS_LOGIC_SZ()) != NFS_ERROR_NONE)
+                                   NFS_BLKS_SZ(run)) != NFS_ERROR_NONE)
             {
                 NFS_DBG("[%s] io error\n", __func__);
                 return -NFS_ERROR_IO;
@@ -234,14 +419,25 @@ int newfs_sync_inode(struct newfs_inode *inode)
  *
  * @param inode
  * @param dentry
- * @return int
+ * @return int 目录项数，目录已满或没有空闲块时返回-NFS_ERROR_NOSPACE且不挂入dentry
  */
 int newfs_alloc_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
 {
+    int64_t dno;
+
     if (inode->dir_cnt % DENTRY_PER_BLK == 0) // 一个数据块存满了
     {
+        if (inode->size >= NFS_MAX_SIZE_PER_FILE)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
         // 新分配一个数据块
-        inode->block_pointer[inode->size] = newfs_alloc_data_blk();
+        dno = newfs_alloc_data_blk(newfs_data_goal(inode));
+        if (dno < 0)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        inode->block_pointer[inode->size] = dno;
         inode->size++;
     }
     if (inode->dentrys != NULL)
@@ -265,13 +461,38 @@ int newfs_read_file(struct newfs_inode *inode, char *data, int length, int offse
 
 int newfs_write_file(struct newfs_inode *inode, const char *data, int length, int offset)
 {
-    if (inode->size < (NFS_ROUND_UP(offset + length, NFS_LOGIC_SZ()) / NFS_LOGIC_SZ()))
+    int blks = NFS_ROUND_UP(offset + length, NFS_LOGIC_SZ()) / NFS_LOGIC_SZ();
+    int64_t goal, dno, len;
+
+    if (blks > NFS_MAX_SIZE_PER_FILE)
     {
-        int nums = (NFS_ROUND_UP(offset + length, NFS_LOGIC_SZ()) / NFS_LOGIC_SZ()) - inode->size;
-        for (int i = 0; i < nums; i++)
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (inode->size < blks)
+    {
+        int nums = blks - inode->size;
+        int grown = 0;
+        /* 按区段分配，优先紧接文件的末块，顺序读写时不必寻道 */
+        goal = newfs_data_goal(inode);
+        while (grown < nums)
         {
-            inode->block_pointer[inode->size++] = newfs_alloc_data_blk();
+            dno = newfs_alloc_data_extent(goal, nums - grown, &len);
+            if (dno < 0)
+            {
+                /* 空间不足时退还本次分配的块，文件保持原样 */
+                while (grown > 0)
+                {
+                    newfs_space_free(inode->block_pointer[inode->size + --grown]);
+                }
+                return -NFS_ERROR_NOSPACE;
+            }
+            for (int64_t i = 0; i < len; i++)
+            {
+                inode->block_pointer[inode->size + grown++] = dno + i;
+            }
+            goal = dno + len;
         }
+        inode->size = blks;
         if (inode->data)
         {
             char *initial_data = inode->data;
@@ -288,6 +509,7 @@ int newfs_write_file(struct newfs_inode *inode, const char *data, int length, in
 
     if (data != NULL)
         memcpy(inode->data + offset, data, length);
+    return NFS_ERROR_NONE;
 }
 
 /**
@@ -363,11 +585,8 @@ int newfs_drop_inode(struct newfs_inode *inode)
     struct newfs_dentry *dentry_to_free;
     struct newfs_inode *inode_cursor;
 
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int ino_cursor = 0;
-    int data_cursor = 0;
-    boolean is_find = FALSE;
+    int blk_cursor = 0;
+    int64_t dno;
 
     if (inode == newfs_super.root_dentry->inode)
     {
@@ -385,51 +604,27 @@ int newfs_drop_inode(struct newfs_inode *inode)
             newfs_drop_dentry(inode, dentry_cursor);
             dentry_to_free = dentry_cursor;
             dentry_cursor = dentry_cursor->brother;
-            free(dentry_to_free);
+            newfs_slab_free(&newfs_dentry_slab, dentry_to_free);
         }
     }
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.ino_map_blks);
-         byte_cursor++) /* 调整inodemap */
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
-        {
-            if (ino_cursor == inode->ino)
-            {
-                newfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                is_find = TRUE;
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find == TRUE)
-        {
-            break;
-        }
-    }
+    newfs_group_free_inode(inode->ino, NFS_IS_DIR(inode)); /* 调整inodemap */
 
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(newfs_super.data_map_blks);
-         byte_cursor++) /* 调整inodemap */
+    /* 调整datamap，释放的数据块登记丢弃，由调用者批量下发 */
+    for (blk_cursor = 0; blk_cursor < inode->size && blk_cursor < NFS_MAX_SIZE_PER_FILE; blk_cursor++)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
-        {
-            if (data_cursor == inode->ino)
-            {
-                newfs_super.map_data[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                is_find = TRUE;
-                break;
-            }
-            data_cursor++;
-        }
-        if (is_find == TRUE)
+        dno = inode->block_pointer[blk_cursor];
+        if (dno < 0 || dno >= newfs_super.data_blks)
         {
-            break;
+            continue;
         }
+        newfs_space_free(dno);
+        newfs_sched_submit_discard(dno);
     }
 
     if (inode->data)
         free(inode->data);
-    free(inode);
+    newfs_slab_free(&newfs_inode_slab, inode);
 
     return NFS_ERROR_NONE;
 }
@@ -466,59 +661,69 @@ struct newfs_dentry *newfs_get_dentry(struct newfs_inode *inode, int dir)
  */
 struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino)
 {
-    struct newfs_inode *inode = (struct newfs_inode *)malloc(sizeof(struct newfs_inode));
-    struct newfs_inode_d inode_d;
+    struct newfs_inode *inode = (struct newfs_inode *)newfs_slab_alloc(&newfs_inode_slab);
+    struct newfs_inode_d inode_buf;
+    const struct newfs_inode_d *inode_d;
     struct newfs_dentry *sub_dentry;
-    struct newfs_dentry_d dentry_d;
+    struct newfs_dentry_d dentry_buf;
+    const struct newfs_dentry_d *dentry_d;
     int dir_cnt = 0;
     int read_length = 0;
-    int offset = 0;
+    int64_t offset = 0;
     int index = 0;
 
-    if (newfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d,
-                          sizeof(struct newfs_inode_d)) != NFS_ERROR_NONE)
+    inode_d = (const struct newfs_inode_d *)newfs_driver_peek(NFS_INO_OFS(ino), sizeof(struct newfs_inode_d),
+                                                              (uint8_t *)&inode_buf);
+    if (inode_d == NULL)
     {
         NFS_DBG("[%s] io error\n", __func__);
         return NULL;
     }
     inode->dir_cnt = 0;
-    inode->ino = inode_d.ino;
-    inode->size = inode_d.size;
-    memcpy(inode->block_pointer, inode_d.block_pointer, NFS_MAX_SIZE_PER_FILE * sizeof(int));
+    inode->ino = inode_d->ino;
+    inode->size = inode_d->size;
+    memcpy(inode->block_pointer, inode_d->block_pointer, NFS_MAX_SIZE_PER_FILE * sizeof(int64_t));
     inode->dentry = dentry;
     inode->dentrys = NULL;
     if (NFS_IS_DIR(inode))
     {
-        offset = NFS_DATA_OFS(inode->block_pointer[index++]);
-        dir_cnt = inode_d.dir_cnt;
+        offset = NFS_DATA_OFS(inode->block_pointer[index]);
+        index++;
+        dir_cnt = inode_d->dir_cnt;
         for (int i = 0; i < dir_cnt; i++)
         {
-            if (newfs_driver_read(offset, (uint8_t *)&dentry_d,
-                                  sizeof(struct newfs_dentry_d)) != NFS_ERROR_NONE)
+            dentry_d = (const struct newfs_dentry_d *)newfs_driver_peek(offset, sizeof(struct newfs_dentry_d),
+                                                                        (uint8_t *)&dentry_buf);
+            if (dentry_d == NULL)
             {
                 NFS_DBG("[%s] io error\n", __func__);
                 return NULL;
             }
-            sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
+            sub_dentry = new_dentry((char *)dentry_d->fname, dentry_d->ftype);
             sub_dentry->parent = inode->dentry;
-            sub_dentry->ino = dentry_d.ino;
-            newfs_alloc_dentry(inode, sub_dentry);
+            sub_dentry->ino = dentry_d->ino;
+            /* 目录项所在的数据块已记录在block_pointer中，不能经newfs_alloc_dentry重复分配 */
+            sub_dentry->brother = inode->dentrys;
+            inode->dentrys = sub_dentry;
+            inode->dir_cnt++;
             read_length += sizeof(struct newfs_dentry_d);
             offset += sizeof(struct newfs_dentry_d);
-            if (read_length + sizeof(struct newfs_dentry_d) > NFS_LOGIC_SZ())
+            if (read_length + sizeof(struct newfs_dentry_d) > NFS_LOGIC_SZ() && i + 1 < dir_cnt)
             {
                 read_length = 0;
-                offset = NFS_DATA_OFS(inode->block_pointer[index++]);
+                offset = NFS_DATA_OFS(inode->block_pointer[index]);
+                index++;
             }
         }
     }
     else if (NFS_IS_REG(inode))
     {
         inode->data = (uint8_t *)malloc(NFS_BLKS_SZ(inode->size));
-        for (int i = 0; i < inode->size; i++)
+        for (int i = 0, run; i < inode->size; i += run)
         {
+            run = newfs_blk_run(inode, i);
             if (newfs_driver_read(NFS_DATA_OFS(inode->block_pointer[i]), (uint8_t *)(inode->data + i * NFS_LOGIC_SZ()),
-                                  NFS_LOGIC_SZ()) != NFS_ERROR_NONE)
+                                  NFS_BLKS_SZ(run)) != NFS_ERROR_NONE)
             {
                 NFS_DBG("[%s] io error\n", __func__);
                 return NULL;
@@ -592,9 +797,10 @@ struct newfs_dentry *newfs_lookup(const char *path, boolean *is_find, boolean *i
     int lvl = 0;
     boolean is_hit;
     char *fname = NULL;
-    char *path_cpy = (char *)malloc(sizeof(path));
+    char path_cpy[PATH_MAX];
     *is_root = FALSE;
-    strcpy(path_cpy, path);
+    strncpy(path_cpy, path, PATH_MAX - 1);
+    path_cpy[PATH_MAX - 1] = '\0';
 
     if (total_lvl == 0)
     { /* 根目录 */
@@ -664,48 +870,85 @@ struct newfs_dentry *newfs_lookup(const char *path, boolean *is_find, boolean *i
  * @brief 挂载newfs, Layout 如下
  *
  * Layout
- * | Super | Inode Map | Data Map | Inodes | Data |
+ * | Super | GDT | Group 0 | Group 1 | ... |
+ * Group: | Inode Map | Data Map | Inodes | Data |
  *
  * 2 * IO_SZ = BLK_SZ
  *
- * 每个Inode占用一个Blk
+ * 每个数据块配一个Inode，组位图在首次分配或释放时才载入
  * @param options
  * @return int
  */
 int newfs_mount(struct custom_options options)
 {
-    int driver_fd;
     struct newfs_super_d newfs_super_d;
-    struct newfs_dentry *root_dentry;
+    struct newfs_dentry *root_dentry = NULL;
     struct newfs_inode *root_inode;
 
-    int logic_blk_num;
+    int64_t logic_blk_num;
+    int nr_members;
+    int ret;
 
     boolean is_init = FALSE;
 
     newfs_super.is_mounted = FALSE;
 
-    // driver_fd = open(options.device, O_RDWR);
-    driver_fd = ddriver_open(options.device);
-
-    if (driver_fd < 0)
+    ret = newfs_tier_open(options);
+    if (ret != NFS_ERROR_NONE)
     {
-        return driver_fd;
+        return ret;
     }
 
-    newfs_super.driver_fd = driver_fd;
-    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE, &newfs_super.sz_disk);
-    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);
+    newfs_super.sz_disk = newfs_volume.size;
+    newfs_super.sz_io = newfs_volume.sz_io;
     // Set one logic block = 2 IO block
     newfs_super.sz_logic = newfs_super.sz_io * 2;
 
+    if (newfs_cache_init(options.cache_kb) != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_NOSPACE;
+        goto err_close;
+    }
+
     root_dentry = new_dentry("/", NFS_DIR);
 
     // 读入超级块
     if (newfs_driver_read(NFS_SUPER_OFS, (uint8_t *)(&newfs_super_d),
                           sizeof(struct newfs_super_d)) != NFS_ERROR_NONE)
     {
-        return -NFS_ERROR_IO;
+        ret = -NFS_ERROR_IO;
+        goto err_close;
+    }
+
+    /* 旧格式的偏移为32位或没有块组，无法原地沿用 */
+    if (newfs_super_d.magic_num == NFS_MAGIC_NUM && newfs_super_d.version != NFS_SUPER_VERSION)
+    {
+        NFS_DBG("[%s] unsupported super version %u, please reformat\n", __func__, newfs_super_d.version);
+        ret = -NFS_ERROR_UNSUPPORTED;
+        goto err_close;
+    }
+
+    /* 超级块总在卷的开头，卷的组成、级别或条带单元变了数据就对不上 */
+    nr_members = newfs_super_d.nr_members ? newfs_super_d.nr_members : 1;
+    if (newfs_super_d.magic_num == NFS_MAGIC_NUM &&
+        (nr_members != newfs_volume.nr_members || newfs_super_d.raid_level != newfs_volume.level ||
+         (nr_members > 1 && newfs_super_d.stripe_sz != newfs_volume.stripe_sz)))
+    {
+        NFS_DBG("[%s] formatted as %d members, raid %d, %d stripe, got %d members, raid %d, %d stripe\n",
+                __func__, nr_members, newfs_super_d.raid_level, newfs_super_d.stripe_sz,
+                newfs_volume.nr_members, newfs_volume.level, newfs_volume.stripe_sz);
+        ret = -NFS_ERROR_INVAL;
+        goto err_close;
+    }
+
+    /* 元数据固定在快层，慢层上只有超级块的副本；没有快层或快层没有分层头
+     * (空白或换过的镜像)时，慢层上的其余元数据和快层上的脏块都不可信 */
+    if (newfs_super_d.magic_num == NFS_MAGIC_NUM && newfs_super_d.tier_magic == NFS_TIER_MAGIC &&
+        newfs_tier.blk_sz == 0)
+    {
+        NFS_DBG("[%s] metadata lives on a fast tier, mount with its original --fast image\n", __func__);
+        ret = -NFS_ERROR_INVAL;
+        goto err_close;
     }
 
     /* 读取super */
@@ -719,67 +962,106 @@ int newfs_mount(struct custom_options options)
         // 注意，单位都是逻辑块
         newfs_super_d.sb_offset = 0;
         newfs_super_d.sb_blks = 1;
-        newfs_super_d.ino_map_offset = newfs_super_d.sb_offset + newfs_super_d.sb_blks;
-        newfs_super_d.ino_map_blks = 1;
-        newfs_super_d.data_map_offset = newfs_super_d.ino_map_offset + newfs_super_d.ino_map_blks;
-        newfs_super_d.data_map_blks = 1;
-        newfs_super_d.ino_offset = newfs_super_d.data_map_offset + newfs_super_d.data_map_blks;
-        newfs_super_d.ino_blks = NFS_ROUND_UP((logic_blk_num * sizeof(struct newfs_inode_d)), NFS_LOGIC_SZ()) / NFS_LOGIC_SZ();
-        newfs_super_d.data_offset = newfs_super_d.ino_offset + newfs_super_d.ino_blks;
-        newfs_super_d.data_blks = logic_blk_num - newfs_super_d.sb_blks - newfs_super_d.ino_map_blks - newfs_super_d.data_map_blks - newfs_super_d.ino_blks;
+        /* 组内的位图各占一块，每个数据块配一个inode */
+        newfs_super_d.blks_per_group = NFS_GROUP_BLKS < NFS_BLKS_SZ(UINT8_BITS) ? NFS_GROUP_BLKS : NFS_BLKS_SZ(UINT8_BITS);
+        newfs_super_d.group_meta_blks = NFS_GROUP_MAP_BLKS +
+                                        NFS_ROUND_UP(newfs_super_d.blks_per_group * sizeof(struct newfs_inode_d),
+                                                     NFS_LOGIC_SZ()) / NFS_LOGIC_SZ();
+        newfs_super_d.ino_per_group = (newfs_super_d.group_meta_blks - NFS_GROUP_MAP_BLKS) * INODE_PER_BLK;
+        if (newfs_super_d.ino_per_group > NFS_BLKS_SZ(UINT8_BITS))
+        {
+            newfs_super_d.ino_per_group = NFS_BLKS_SZ(UINT8_BITS);
+        }
+        newfs_super_d.data_per_group = newfs_super_d.blks_per_group - newfs_super_d.group_meta_blks;
+        /* 描述符表按组数的上限估算，末组至少要放下位图、inode表和一个数据块 */
+        newfs_super_d.gdt_offset = newfs_super_d.sb_offset + newfs_super_d.sb_blks;
+        newfs_super_d.gdt_blks = NFS_ROUND_UP(NFS_ROUND_UP(logic_blk_num, newfs_super_d.blks_per_group) /
+                                                  newfs_super_d.blks_per_group * sizeof(struct newfs_group_d),
+                                              NFS_LOGIC_SZ()) / NFS_LOGIC_SZ();
+        newfs_super_d.group_offset = newfs_super_d.gdt_offset + newfs_super_d.gdt_blks;
+        newfs_super_d.nr_groups = (logic_blk_num - newfs_super_d.group_offset) / newfs_super_d.blks_per_group;
+        newfs_super_d.data_blks = newfs_super_d.nr_groups * newfs_super_d.data_per_group;
+        if ((logic_blk_num - newfs_super_d.group_offset) % newfs_super_d.blks_per_group > newfs_super_d.group_meta_blks)
+        {
+            newfs_super_d.data_blks += (logic_blk_num - newfs_super_d.group_offset) % newfs_super_d.blks_per_group -
+                                       newfs_super_d.group_meta_blks;
+            newfs_super_d.nr_groups++;
+        }
+        if (newfs_super_d.nr_groups == 0)
+        {
+            NFS_DBG("[%s] %ld blocks is too small for a block group\n", __func__, (long)logic_blk_num);
+            ret = -NFS_ERROR_NOSPACE;
+            goto err_close;
+        }
 
         newfs_super_d.sz_usage = 0;
         is_init = TRUE;
     }
     newfs_super.sb_offset = newfs_super_d.sb_offset; /* 建立 in-memory 结构 */
     newfs_super.sb_blks = newfs_super_d.sb_blks;
-    newfs_super.ino_map_offset = newfs_super_d.ino_map_offset;
-    newfs_super.ino_map_blks = newfs_super_d.ino_map_blks;
-    newfs_super.data_map_offset = newfs_super_d.data_map_offset;
-    newfs_super.data_map_blks = newfs_super_d.data_map_blks;
-    newfs_super.ino_offset = newfs_super_d.ino_offset;
-    newfs_super.ino_blks = newfs_super_d.ino_blks;
-    newfs_super.data_offset = newfs_super_d.data_offset;
+    newfs_super.gdt_offset = newfs_super_d.gdt_offset;
+    newfs_super.gdt_blks = newfs_super_d.gdt_blks;
+    newfs_super.group_offset = newfs_super_d.group_offset;
+    newfs_super.nr_groups = newfs_super_d.nr_groups;
+    newfs_super.blks_per_group = newfs_super_d.blks_per_group;
+    newfs_super.group_meta_blks = newfs_super_d.group_meta_blks;
+    newfs_super.ino_per_group = newfs_super_d.ino_per_group;
+    newfs_super.data_per_group = newfs_super_d.data_per_group;
     newfs_super.data_blks = newfs_super_d.data_blks;
     newfs_super.sz_usage = newfs_super_d.sz_usage;
 
-    // TODO: if init, should zero?
-    newfs_super.map_inode = (uint8_t *)malloc(NFS_BLKS_SZ(newfs_super.ino_map_blks));
-    newfs_super.map_data = (uint8_t *)malloc(NFS_BLKS_SZ(newfs_super.data_map_blks));
-
-    if (!is_init)
+    /* 超级块、组描述符表与各组的位图、inode表固定在快层 */
+    if (newfs_tier_attach(NFS_BLKS_SZ(newfs_super.group_offset), NFS_BLKS_SZ(newfs_super.blks_per_group),
+                          NFS_BLKS_SZ(newfs_super.group_meta_blks), newfs_super.nr_groups,
+                          NFS_LOGIC_SZ()) != NFS_ERROR_NONE)
     {
-        if (newfs_driver_read(NFS_BLKS_SZ(newfs_super_d.ino_map_offset), (uint8_t *)(newfs_super.map_inode),
-                              NFS_BLKS_SZ(newfs_super_d.ino_map_blks)) != NFS_ERROR_NONE)
-        {
-            return -NFS_ERROR_IO;
-        }
-
-        if (newfs_driver_read(NFS_BLKS_SZ(newfs_super_d.data_map_offset), (uint8_t *)(newfs_super.map_data),
-                              NFS_BLKS_SZ(newfs_super_d.data_map_blks)) != NFS_ERROR_NONE)
-        {
-            return -NFS_ERROR_IO;
-        }
+        ret = -NFS_ERROR_INVAL;
+        goto err_close;
     }
-    else
+
+    ret = newfs_group_init(is_init);
+    if (ret != NFS_ERROR_NONE)
     {
-        memset(newfs_super.map_inode, 0, NFS_BLKS_SZ(newfs_super.ino_map_blks));
-        memset(newfs_super.map_data, 0, NFS_BLKS_SZ(newfs_super.data_map_blks));
+        goto err_close;
     }
 
+    /* 空闲统计取自组描述符，sz_usage随之修正 */
+    newfs_space_build();
+
     // TODO 根节点的建立与分配
     if (is_init)
     { /* 分配根节点 */
         root_inode = newfs_alloc_inode(root_dentry);
-        newfs_sync_inode(root_inode);
+        if (root_inode == NULL || newfs_sync_inode(root_inode) != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_IO;
+            goto err_close;
+        }
     }
 
     root_inode = newfs_read_inode(root_dentry, NFS_ROOT_INO);
+    if (root_inode == NULL)
+    {
+        ret = -NFS_ERROR_IO;
+        goto err_close;
+    }
     root_dentry->inode = root_inode;
     newfs_super.root_dentry = root_dentry;
     newfs_super.is_mounted = TRUE;
 
     return NFS_ERROR_NONE;
+
+err_close:
+    /* 挂载失败时关掉已打开的成员设备，驱动的句柄槽位有限 */
+    if (root_dentry != NULL)
+    {
+        newfs_slab_free(&newfs_dentry_slab, root_dentry);
+    }
+    newfs_group_destroy();
+    newfs_space_destroy();
+    newfs_cache_destroy();
+    newfs_tier_close();
+    return ret;
 }
 
 /**
@@ -800,17 +1082,23 @@ int newfs_umount()
     newfs_sync_inode(newfs_super.root_dentry->inode); /* 从根节点向下刷写节点 */
 
     newfs_super_d.magic_num = NFS_MAGIC_NUM;
+    newfs_super_d.version = NFS_SUPER_VERSION;
     newfs_super_d.sb_offset = newfs_super.sb_offset; /* 建立 in-disk 结构 */
     newfs_super_d.sb_blks = newfs_super.sb_blks;
-    newfs_super_d.ino_map_offset = newfs_super.ino_map_offset;
-    newfs_super_d.ino_map_blks = newfs_super.ino_map_blks;
-    newfs_super_d.data_map_offset = newfs_super.data_map_offset;
-    newfs_super_d.data_map_blks = newfs_super.data_map_blks;
-    newfs_super_d.ino_offset = newfs_super.ino_offset;
-    newfs_super_d.ino_blks = newfs_super.ino_blks;
-    newfs_super_d.data_offset = newfs_super.data_offset;
+    newfs_super_d.gdt_offset = newfs_super.gdt_offset;
+    newfs_super_d.gdt_blks = newfs_super.gdt_blks;
+    newfs_super_d.group_offset = newfs_super.group_offset;
+    newfs_super_d.nr_groups = newfs_super.nr_groups;
+    newfs_super_d.blks_per_group = newfs_super.blks_per_group;
+    newfs_super_d.group_meta_blks = newfs_super.group_meta_blks;
+    newfs_super_d.ino_per_group = newfs_super.ino_per_group;
+    newfs_super_d.data_per_group = newfs_super.data_per_group;
     newfs_super_d.data_blks = newfs_super.data_blks;
     newfs_super_d.sz_usage = newfs_super.sz_usage;
+    newfs_super_d.nr_members = newfs_volume.nr_members;
+    newfs_super_d.stripe_sz = newfs_volume.stripe_sz;
+    newfs_super_d.raid_level = newfs_volume.level;
+    newfs_super_d.tier_magic = newfs_tier.blk_sz != 0 ? NFS_TIER_MAGIC : 0;
 
     if (newfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&newfs_super_d,
                            sizeof(struct newfs_super_d)) != NFS_ERROR_NONE)
@@ -818,21 +1106,24 @@ int newfs_umount()
         return -NFS_ERROR_IO;
     }
 
-    if (newfs_driver_write(NFS_BLKS_SZ(newfs_super_d.ino_map_offset), (uint8_t *)(newfs_super.map_inode),
-                           NFS_BLKS_SZ(newfs_super_d.ino_map_blks)) != NFS_ERROR_NONE)
+    if (newfs_group_flush() != NFS_ERROR_NONE)
     {
         return -NFS_ERROR_IO;
     }
 
-    if (newfs_driver_write(NFS_BLKS_SZ(newfs_super_d.data_map_offset), (uint8_t *)(newfs_super.map_data),
-                           NFS_BLKS_SZ(newfs_super_d.data_map_blks)) != NFS_ERROR_NONE)
+    if (newfs_driver_sync() != NFS_ERROR_NONE)
     {
         return -NFS_ERROR_IO;
     }
-
-    free(newfs_super.map_inode);
-    free(newfs_super.map_data);
-    ddriver_close(NFS_DRIVER());
+    newfs_cache_destroy();
+    newfs_sched_destroy();
+
+    newfs_group_destroy();
+    newfs_space_destroy();
+    /* 内存中的dentry与inode树随对象池一并释放 */
+    newfs_slab_destroy(&newfs_dentry_slab);
+    newfs_slab_destroy(&newfs_inode_slab);
+    newfs_tier_close();
 
     return NFS_ERROR_NONE;
 }
\ No newline at end of file
@@ -0,0 +1,1282 @@
+#include "newfs.h"
+
+extern struct newfs_volume newfs_volume;
+
+/******************************************************************************
+ * SECTION: 内部函数
+ *******************************************************************************/
+/**
+ * @brief 关闭前n个成员
+ *
+ * @param n
+ */
+static void members_close(int n)
+{
+    struct newfs_member *member;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        member = &newfs_volume.members[i];
+        if (member->aio_fd >= 0)
+        {
+            ddriver_close(member->aio_fd);
+        }
+        if (member->fd >= 0)
+        {
+            ddriver_close(member->fd);
+        }
+        free(member->path);
+        member->path = NULL;
+    }
+}
+
+/**
+ * @brief 打开一个成员设备，同一镜像打开两个句柄，
+ * 调度器与跨成员拆分各用一个异步队列，互不收割对方的请求
+ *
+ * @param member
+ * @param path
+ * @param mmap 切换到MMAP后端
+ * @return int
+ */
+static int member_open(struct newfs_member *member, const char *path, boolean mmap)
+{
+    int backend = DDRIVER_BACKEND_MMAP;
+
+    member->path = strdup(path);
+    member->failed = FALSE;
+    member->fd = ddriver_open(member->path);
+    member->aio_fd = member->fd < 0 ? -1 : ddriver_open(member->path);
+    if (member->fd < 0 || member->aio_fd < 0)
+    {
+        NFS_DBG("[%s] open %s failed\n", __func__, path);
+        return -NFS_ERROR_IO;
+    }
+    /* 后端属于设备而非句柄，经任一句柄切换即可 */
+    if (mmap && ddriver_ioctl(member->fd, IOC_REQ_DEVICE_BACKEND, &backend) != 0)
+    {
+        NFS_DBG("[%s] mmap backend unavailable on %s, use file backend\n", __func__, path);
+    }
+    if (ddriver_ioctl(member->fd, IOC_REQ_DEVICE_SIZE64, &member->size) != 0)
+    {
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+
+static int members_healthy()
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        n += !newfs_volume.members[i].failed;
+    }
+    return n;
+}
+
+/**
+ * @brief 在当前的故障成员下卷是否仍有完整数据
+ *
+ * @return boolean
+ */
+static boolean members_intact()
+{
+    int failed = newfs_volume.nr_members - members_healthy();
+
+    if (newfs_volume.level == NFS_RAID_MIRROR)
+    {
+        return failed < newfs_volume.nr_members;
+    }
+    return failed <= newfs_volume.nr_parity;
+}
+
+/**
+ * @brief 条带卷的地址映射，结果不跨越条带单元
+ *
+ * @param offset 卷内偏移
+ * @param size 期望长度
+ * @param member_off 返回成员内偏移
+ * @param len 返回不超过size、且止于条带单元边界的长度
+ * @return int 成员下标
+ */
+static int stripe_map(int64_t offset, int size, int64_t *member_off, int *len)
+{
+    int64_t stripe;
+    int bias;
+
+    if (newfs_volume.nr_members == 1)
+    {
+        *member_off = offset;
+        *len = size;
+        return 0;
+    }
+    stripe = offset / newfs_volume.stripe_sz;
+    bias = offset % newfs_volume.stripe_sz;
+    *member_off = stripe / newfs_volume.nr_members * newfs_volume.stripe_sz + bias;
+    *len = newfs_volume.stripe_sz - bias < size ? newfs_volume.stripe_sz - bias : size;
+    return stripe % newfs_volume.nr_members;
+}
+
+/**
+ * @brief 将一批子请求按成员分组，先全部下发到各成员的aio_fd再逐个收割，
+ * 成员之间的设备时间相互重叠；调用者持有newfs_volume.lock
+ *
+ * @param reqs 完成后res即结果，未能下发的为-EIO
+ * @param members 各子请求的目标成员
+ * @param nr 不超过NFS_VOL_BATCH
+ */
+static void vol_batch(struct ddriver_req *reqs, const int *members, int nr)
+{
+    struct ddriver_req *batch[NFS_VOL_MAX_MEMBERS][NFS_VOL_BATCH];
+    struct ddriver_req *done[NFS_VOL_BATCH];
+    int nr_batch[NFS_VOL_MAX_MEMBERS];
+    int member, i;
+
+    memset(nr_batch, 0, sizeof(nr_batch));
+    for (i = 0; i < nr; i++)
+    {
+        reqs[i].res = -EIO;
+        batch[members[i]][nr_batch[members[i]]++] = &reqs[i];
+    }
+    newfs_volume.chunk_cnt += nr;
+
+    for (member = 0; member < newfs_volume.nr_members; member++)
+    {
+        if (nr_batch[member] > 0)
+        {
+            i = ddriver_submit(newfs_volume.members[member].aio_fd, batch[member], nr_batch[member]);
+            nr_batch[member] = i < 0 ? 0 : i;
+        }
+    }
+    /* 已下发的子请求引用调用者的缓冲区，须全部收割 */
+    for (member = 0; member < newfs_volume.nr_members; member++)
+    {
+        if (nr_batch[member] > 0)
+        {
+            ddriver_wait(newfs_volume.members[member].aio_fd, done, nr_batch[member], NFS_VOL_BATCH);
+        }
+    }
+}
+
+/**
+ * @brief 条带卷读写：落在一个条带单元内的请求同步访问该成员，
+ * 否则按条带单元切分后经vol_batch并行下发
+ *
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param offset 按IO单元对齐的卷内偏移
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+static int stripe_rw(int op, int64_t offset, uint8_t *buf, int size)
+{
+    struct ddriver_req reqs[NFS_VOL_BATCH];
+    int members[NFS_VOL_BATCH];
+    int64_t member_off;
+    int member, len, nr, i;
+    int ret = NFS_ERROR_NONE;
+
+    member = stripe_map(offset, size, &member_off, &len);
+    if (len == size)
+    {
+        nr = op == DDRIVER_OP_READ
+                 ? ddriver_pread(NFS_MEMBER_FD(member), (char *)buf, size, member_off)
+                 : ddriver_pwrite(NFS_MEMBER_FD(member), (char *)buf, size, member_off);
+        return nr < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+    }
+
+    pthread_mutex_lock(&newfs_volume.lock);
+    newfs_volume.split_cnt++;
+    while (size > 0 && ret == NFS_ERROR_NONE)
+    {
+        memset(reqs, 0, sizeof(reqs));
+        for (nr = 0; nr < NFS_VOL_BATCH && size > 0; nr++)
+        {
+            members[nr] = stripe_map(offset, size, &member_off, &len);
+            reqs[nr].op = op;
+            reqs[nr].buf = (char *)buf;
+            reqs[nr].size = len;
+            reqs[nr].offset = member_off;
+            offset += len;
+            buf += len;
+            size -= len;
+        }
+        vol_batch(reqs, members, nr);
+        for (i = 0; i < nr; i++)
+        {
+            if (reqs[i].res != (int)reqs[i].size)
+            {
+                NFS_DBG("[%s] member %d offset %ld failed: %d\n", __func__,
+                        members[i], (long)reqs[i].offset, reqs[i].res);
+                ret = -NFS_ERROR_IO;
+            }
+        }
+    }
+    pthread_mutex_unlock(&newfs_volume.lock);
+    return ret;
+}
+
+/**
+ * @brief 为一次镜像读挑选成员：按驱动的旋转模型取磁头定位代价最小者，
+ * 代价相同时从轮转起点开始取，使读在各成员间分摊
+ *
+ * @param offset
+ * @return int 成员下标，无可用成员时返回-1
+ */
+static int mirror_pick(int64_t offset)
+{
+    struct ddriver_pos_cost pos;
+    int64_t best_cost = INT64_MAX;
+    int start = __atomic_load_n(&newfs_volume.rr, __ATOMIC_RELAXED);
+    int best = -1;
+    int member, i;
+
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        member = (start + i) % newfs_volume.nr_members;
+        if (newfs_volume.members[member].failed)
+        {
+            continue;
+        }
+        pos.offset = offset;
+        if (ddriver_ioctl(NFS_MEMBER_FD(member), IOC_REQ_DEVICE_POS_COST, &pos) != 0)
+        {
+            continue;
+        }
+        if (pos.cost_ns < best_cost)
+        {
+            best_cost = pos.cost_ns;
+            best = member;
+        }
+    }
+    if (best >= 0)
+    {
+        __atomic_store_n(&newfs_volume.rr, (best + 1) % newfs_volume.nr_members, __ATOMIC_RELAXED);
+    }
+    return best;
+}
+
+/**
+ * @brief 镜像读：小请求交给定位代价最小的成员，失败则改读其余成员；
+ * 大请求按条带单元切分后轮流交给各成员并行读
+ *
+ * @param offset 按IO单元对齐
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+static int mirror_read(int64_t offset, uint8_t *buf, int size)
+{
+    struct ddriver_req reqs[NFS_VOL_BATCH];
+    int members[NFS_VOL_BATCH];
+    int member, len, nr, i;
+    int ret = NFS_ERROR_NONE;
+
+    if (size <= newfs_volume.stripe_sz || members_healthy() == 1)
+    {
+        while ((member = mirror_pick(offset)) >= 0)
+        {
+            if (ddriver_pread(NFS_MEMBER_FD(member), (char *)buf, size, offset) >= 0)
+            {
+                return NFS_ERROR_NONE;
+            }
+            newfs_vol_fail(member);
+            newfs_volume.retry_cnt++;
+        }
+        return -NFS_ERROR_IO;
+    }
+
+    pthread_mutex_lock(&newfs_volume.lock);
+    newfs_volume.split_cnt++;
+    member = newfs_volume.rr;
+    while (size > 0 && ret == NFS_ERROR_NONE)
+    {
+        memset(reqs, 0, sizeof(reqs));
+        for (nr = 0; nr < NFS_VOL_BATCH && size > 0; nr++)
+        {
+            while (newfs_volume.members[member].failed)
+            {
+                member = (member + 1) % newfs_volume.nr_members;
+            }
+            len = newfs_volume.stripe_sz - offset % newfs_volume.stripe_sz;
+            len = len < size ? len : size;
+            members[nr] = member;
+            reqs[nr].op = DDRIVER_OP_READ;
+            reqs[nr].buf = (char *)buf;
+            reqs[nr].size = len;
+            reqs[nr].offset = offset;
+            member = (member + 1) % newfs_volume.nr_members;
+            offset += len;
+            buf += len;
+            size -= len;
+        }
+        vol_batch(reqs, members, nr);
+        /* 失败的子请求不超过一个条带单元，同步改读其余成员 */
+        for (i = 0; i < nr; i++)
+        {
+            if (reqs[i].res != (int)reqs[i].size)
+            {
+                newfs_vol_fail(members[i]);
+                if (mirror_read(reqs[i].offset, (uint8_t *)reqs[i].buf, reqs[i].size) != NFS_ERROR_NONE)
+                {
+                    ret = -NFS_ERROR_IO;
+                }
+            }
+        }
+        if (members_healthy() == 0)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    pthread_mutex_unlock(&newfs_volume.lock);
+    return ret;
+}
+
+/**
+ * @brief 镜像写：同时写入所有正常成员，至少一份写成即成功
+ *
+ * @param offset 按IO单元对齐
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+static int mirror_write(int64_t offset, uint8_t *buf, int size)
+{
+    struct ddriver_req reqs[NFS_VOL_MAX_MEMBERS];
+    int members[NFS_VOL_MAX_MEMBERS];
+    int nr = 0;
+    int ok = 0;
+    int i;
+
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        if (!newfs_volume.members[i].failed)
+        {
+            members[nr++] = i;
+        }
+    }
+    if (nr == 1)
+    {
+        if (ddriver_pwrite(NFS_MEMBER_FD(members[0]), (char *)buf, size, offset) >= 0)
+        {
+            return NFS_ERROR_NONE;
+        }
+        newfs_vol_fail(members[0]);
+        return -NFS_ERROR_IO;
+    }
+
+    memset(reqs, 0, sizeof(reqs));
+    for (i = 0; i < nr; i++)
+    {
+        reqs[i].op = DDRIVER_OP_WRITE;
+        reqs[i].buf = (char *)buf;
+        reqs[i].size = size;
+        reqs[i].offset = offset;
+    }
+    pthread_mutex_lock(&newfs_volume.lock);
+    vol_batch(reqs, members, nr);
+    pthread_mutex_unlock(&newfs_volume.lock);
+    for (i = 0; i < nr; i++)
+    {
+        if (reqs[i].res == (int)reqs[i].size)
+        {
+            ok++;
+        }
+        else
+        {
+            newfs_vol_fail(members[i]);
+        }
+    }
+    return ok > 0 ? NFS_ERROR_NONE : -NFS_ERROR_IO;
+}
+
+/**
+ * @brief 校验卷中一行的第unit个单元所在的成员：P校验逐行向前轮转，
+ * Q校验紧随其后，数据单元依次排在校验之后
+ *
+ * @param row 行号，即成员内的条带单元序号
+ * @param unit 0 ~ k-1为数据单元，k为P，k+1为Q
+ * @return int
+ */
+static int parity_member(int64_t row, int unit)
+{
+    int n = newfs_volume.nr_members;
+    int k = n - newfs_volume.nr_parity;
+    int p = n - 1 - row % n;
+
+    return (p + (unit >= k ? unit - k : newfs_volume.nr_parity + unit)) % n;
+}
+
+/**
+ * @brief 校验卷的地址映射，结果不跨越条带单元
+ *
+ * @param offset 卷内偏移
+ * @param size 期望长度
+ * @param member_off 返回成员内偏移
+ * @param len 返回不超过size、且止于条带单元边界的长度
+ * @return int 成员下标
+ */
+static int parity_map(int64_t offset, int size, int64_t *member_off, int *len)
+{
+    int k = newfs_volume.nr_members - newfs_volume.nr_parity;
+    int64_t row = offset / ((int64_t)k * newfs_volume.stripe_sz);
+    int unit = offset / newfs_volume.stripe_sz % k;
+    int bias = offset % newfs_volume.stripe_sz;
+
+    *member_off = row * newfs_volume.stripe_sz + bias;
+    *len = newfs_volume.stripe_sz - bias < size ? newfs_volume.stripe_sz - bias : size;
+    return parity_member(row, unit);
+}
+
+/**
+ * @brief 将一行各数据单元的[lo, hi)读入row_buf，缺失的数据单元由校验重建；
+ * 读失败的成员被摘除后整体重读。调用者持有newfs_volume.lock
+ *
+ * @param row
+ * @param lo 按IO单元对齐的单元内起点
+ * @param hi 按IO单元对齐的单元内终点
+ * @param skip 即将被整段覆盖的数据单元，无需重建其他单元时不读
+ * @return int
+ */
+static int parity_load(int64_t row, int lo, int hi, unsigned skip)
+{
+    struct ddriver_req reqs[NFS_VOL_MAX_MEMBERS];
+    int members[NFS_VOL_MAX_MEMBERS];
+    int missing[NFS_VOL_MAX_MEMBERS];
+    uint8_t *units[NFS_VOL_MAX_MEMBERS];
+    int k = newfs_volume.nr_members - newfs_volume.nr_parity;
+    int nr_missing, nr, member, unit, i;
+    boolean rebuild, retry;
+
+    for (unit = 0; unit < newfs_volume.nr_members; unit++)
+    {
+        units[unit] = newfs_volume.row_buf + unit * newfs_volume.stripe_sz + lo;
+    }
+    do
+    {
+        nr_missing = 0;
+        rebuild = FALSE;
+        for (unit = 0; unit < newfs_volume.nr_members; unit++)
+        {
+            if (newfs_volume.members[parity_member(row, unit)].failed)
+            {
+                missing[nr_missing++] = unit;
+                rebuild |= unit < k && (skip & (1u << unit)) == 0;
+            }
+        }
+        if (nr_missing > newfs_volume.nr_parity)
+        {
+            return -NFS_ERROR_IO;
+        }
+
+        /* 无需重建时只读未被覆盖的数据单元，否则读入全部正常单元 */
+        memset(reqs, 0, sizeof(reqs));
+        nr = 0;
+        for (unit = 0; unit < newfs_volume.nr_members; unit++)
+        {
+            member = parity_member(row, unit);
+            if (newfs_volume.members[member].failed ||
+                (!rebuild && (unit >= k || (skip & (1u << unit)))))
+            {
+                continue;
+            }
+            members[nr] = member;
+            reqs[nr].op = DDRIVER_OP_READ;
+            reqs[nr].buf = (char *)units[unit];
+            reqs[nr].size = hi - lo;
+            reqs[nr].offset = row * newfs_volume.stripe_sz + lo;
+            nr++;
+        }
+        vol_batch(reqs, members, nr);
+        retry = FALSE;
+        for (i = 0; i < nr; i++)
+        {
+            if (reqs[i].res != (int)reqs[i].size)
+            {
+                if (newfs_vol_fail(members[i]) != NFS_ERROR_NONE)
+                {
+                    return -NFS_ERROR_IO;
+                }
+                retry = TRUE;
+            }
+        }
+    } while (retry);
+
+    if (rebuild)
+    {
+        newfs_volume.recon_cnt++;
+        return newfs_parity_rebuild(units, k, newfs_volume.nr_parity, hi - lo, missing, nr_missing);
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 检查一批写的结果，失败的成员被摘除，卷仍完整即视为成功
+ *
+ * @param reqs
+ * @param members
+ * @param nr
+ * @return int
+ */
+static int parity_check_writes(struct ddriver_req *reqs, const int *members, int nr)
+{
+    int i;
+    int ret = NFS_ERROR_NONE;
+
+    for (i = 0; i < nr; i++)
+    {
+        if (reqs[i].res != (int)reqs[i].size && newfs_vol_fail(members[i]) != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief 以整行为单位的写：校验只由新数据算出，无需读取，
+ * 数据单元直接引用调用者的缓冲区，多行合为一批并行下发。调用者持有newfs_volume.lock
+ *
+ * @param offset 按行对齐
+ * @param buf
+ * @param nr_rows 不超过NFS_VOL_BATCH / nr_members
+ * @return int
+ */
+static int parity_write_rows(int64_t offset, uint8_t *buf, int nr_rows)
+{
+    struct ddriver_req reqs[NFS_VOL_BATCH];
+    int members[NFS_VOL_BATCH];
+    uint8_t *units[NFS_VOL_MAX_MEMBERS];
+    int k = newfs_volume.nr_members - newfs_volume.nr_parity;
+    int row_sz = k * newfs_volume.stripe_sz;
+    uint8_t *parity = newfs_volume.row_buf + newfs_volume.nr_members * newfs_volume.stripe_sz;
+    int64_t row = offset / row_sz;
+    int nr = 0;
+    int member, unit, r;
+
+    memset(reqs, 0, sizeof(reqs));
+    for (r = 0; r < nr_rows; r++, row++)
+    {
+        for (unit = 0; unit < newfs_volume.nr_members; unit++)
+        {
+            units[unit] = unit < k ? buf + r * row_sz + unit * newfs_volume.stripe_sz
+                                   : parity + ((r * newfs_volume.nr_parity) + unit - k) * newfs_volume.stripe_sz;
+        }
+        newfs_parity_gen(units, k, newfs_volume.nr_parity, newfs_volume.stripe_sz);
+        for (unit = 0; unit < newfs_volume.nr_members; unit++)
+        {
+            member = parity_member(row, unit);
+            if (newfs_volume.members[member].failed)
+            {
+                continue;
+            }
+            members[nr] = member;
+            reqs[nr].op = DDRIVER_OP_WRITE;
+            reqs[nr].buf = (char *)units[unit];
+            reqs[nr].size = newfs_volume.stripe_sz;
+            reqs[nr].offset = row * newfs_volume.stripe_sz;
+            nr++;
+        }
+    }
+    if (nr == 0)
+    { /* 目标成员都已失效，没有可写的副本 */
+        return -NFS_ERROR_IO;
+    }
+    vol_batch(reqs, members, nr);
+    newfs_volume.full_cnt += nr_rows;
+    return parity_check_writes(reqs, members, nr);
+}
+
+/**
+ * @brief 行内部分写：读出该行受影响区间内未被覆盖的数据，
+ * 与新数据一起重新计算校验后写回，降级时缺失的数据先由校验重建。
+ * 调用者持有newfs_volume.lock
+ *
+ * @param offset 按IO单元对齐，与offset + size同处一行
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+static int parity_write_partial(int64_t offset, uint8_t *buf, int size)
+{
+    struct ddriver_req reqs[NFS_VOL_MAX_MEMBERS];
+    int members[NFS_VOL_MAX_MEMBERS];
+    uint8_t *units[NFS_VOL_MAX_MEMBERS];
+    int su = newfs_volume.stripe_sz;
+    int k = newfs_volume.nr_members - newfs_volume.nr_parity;
+    int64_t row = offset / ((int64_t)k * su);
+    int rbias = offset % ((int64_t)k * su);
+    int first = rbias / su;
+    int last = (rbias + size - 1) / su;
+    int lo = first == last ? rbias % su : 0;
+    int hi = first == last ? (rbias + size - 1) % su + 1 : su;
+    unsigned skip = 0;
+    int start, end, member, unit;
+    int nr = 0;
+    int ret;
+
+    /* 数据单元在行内的写入区间覆盖了[lo, hi)，则其旧内容无用 */
+    for (unit = first; unit <= last; unit++)
+    {
+        start = unit == first ? rbias % su : 0;
+        end = unit == last ? (rbias + size - 1) % su + 1 : su;
+        if (start <= lo && end >= hi)
+        {
+            skip |= 1u << unit;
+        }
+    }
+    ret = parity_load(row, lo, hi, skip);
+    if (ret != NFS_ERROR_NONE)
+    {
+        return ret;
+    }
+    memcpy(newfs_volume.row_buf + rbias, buf, size);
+    for (unit = 0; unit < newfs_volume.nr_members; unit++)
+    {
+        units[unit] = newfs_volume.row_buf + unit * su + lo;
+    }
+    newfs_parity_gen(units, k, newfs_volume.nr_parity, hi - lo);
+
+    memset(reqs, 0, sizeof(reqs));
+    for (unit = first; unit < newfs_volume.nr_members; unit = unit == last ? k : unit + 1)
+    {
+        member = parity_member(row, unit);
+        if (newfs_volume.members[member].failed)
+        {
+            continue;
+        }
+        start = unit == first ? rbias % su : (unit < k ? 0 : lo);
+        end = unit == last ? (rbias + size - 1) % su + 1 : (unit < k ? su : hi);
+        members[nr] = member;
+        reqs[nr].op = DDRIVER_OP_WRITE;
+        reqs[nr].buf = (char *)newfs_volume.row_buf + unit * su + start;
+        reqs[nr].size = end - start;
+        reqs[nr].offset = row * su + start;
+        nr++;
+    }
+    if (nr == 0)
+    { /* 目标成员都已失效，没有可写的副本 */
+        return -NFS_ERROR_IO;
+    }
+    vol_batch(reqs, members, nr);
+    newfs_volume.rmw_cnt++;
+    return parity_check_writes(reqs, members, nr);
+}
+
+/**
+ * @brief 校验卷写：整行部分成批直接写入，首尾不足一行的部分先读后写
+ *
+ * @param offset 按IO单元对齐
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+static int parity_write(int64_t offset, uint8_t *buf, int size)
+{
+    int row_sz = (newfs_volume.nr_members - newfs_volume.nr_parity) * newfs_volume.stripe_sz;
+    int max_rows = NFS_VOL_BATCH / newfs_volume.nr_members;
+    int len, nr_rows;
+    int ret = NFS_ERROR_NONE;
+
+    pthread_mutex_lock(&newfs_volume.lock);
+    while (size > 0 && ret == NFS_ERROR_NONE)
+    {
+        if (offset % row_sz == 0 && size >= row_sz)
+        {
+            nr_rows = size / row_sz < max_rows ? size / row_sz : max_rows;
+            len = nr_rows * row_sz;
+            ret = parity_write_rows(offset, buf, nr_rows);
+        }
+        else
+        {
+            len = row_sz - offset % row_sz < size ? row_sz - offset % row_sz : size;
+            ret = parity_write_partial(offset, buf, len);
+        }
+        offset += len;
+        buf += len;
+        size -= len;
+    }
+    pthread_mutex_unlock(&newfs_volume.lock);
+    return ret;
+}
+
+/**
+ * @brief 校验卷中数据单元缺失或读失败时，由同行其余单元重建后读取。
+ * 调用者持有newfs_volume.lock
+ *
+ * @param offset 按IO单元对齐，不跨越条带单元
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+static int parity_read_degraded(int64_t offset, uint8_t *buf, int size)
+{
+    int k = newfs_volume.nr_members - newfs_volume.nr_parity;
+    int64_t row = offset / ((int64_t)k * newfs_volume.stripe_sz);
+    int unit = offset / newfs_volume.stripe_sz % k;
+    int bias = offset % newfs_volume.stripe_sz;
+    int ret;
+
+    ret = parity_load(row, bias, bias + size, 0);
+    if (ret == NFS_ERROR_NONE)
+    {
+        memcpy(buf, newfs_volume.row_buf + unit * newfs_volume.stripe_sz + bias, size);
+    }
+    return ret;
+}
+
+/**
+ * @brief 校验卷读：只读数据单元，落在一个条带单元内的请求同步读取，
+ * 否则切分后并行下发；缺失或读失败的部分由校验重建
+ *
+ * @param offset 按IO单元对齐
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+static int parity_read(int64_t offset, uint8_t *buf, int size)
+{
+    struct ddriver_req reqs[NFS_VOL_BATCH];
+    int members[NFS_VOL_BATCH];
+    int64_t vol_off[NFS_VOL_BATCH];
+    int64_t member_off;
+    int member, len, nr, i;
+    int ret = NFS_ERROR_NONE;
+
+    member = parity_map(offset, size, &member_off, &len);
+    if (len == size && !newfs_volume.members[member].failed)
+    {
+        if (ddriver_pread(NFS_MEMBER_FD(member), (char *)buf, size, member_off) >= 0)
+        {
+            return NFS_ERROR_NONE;
+        }
+        newfs_volume.retry_cnt++;
+        if (newfs_vol_fail(member) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+
+    pthread_mutex_lock(&newfs_volume.lock);
+    if (len != size)
+    {
+        newfs_volume.split_cnt++;
+    }
+    while (size > 0 && ret == NFS_ERROR_NONE)
+    {
+        memset(reqs, 0, sizeof(reqs));
+        for (nr = 0; nr < NFS_VOL_BATCH && size > 0 && ret == NFS_ERROR_NONE;)
+        {
+            member = parity_map(offset, size, &member_off, &len);
+            if (newfs_volume.members[member].failed)
+            {
+                ret = parity_read_degraded(offset, buf, len);
+            }
+            else
+            {
+                members[nr] = member;
+                vol_off[nr] = offset;
+                reqs[nr].op = DDRIVER_OP_READ;
+                reqs[nr].buf = (char *)buf;
+                reqs[nr].size = len;
+                reqs[nr].offset = member_off;
+                nr++;
+            }
+            offset += len;
+            buf += len;
+            size -= len;
+        }
+        vol_batch(reqs, members, nr);
+        for (i = 0; i < nr; i++)
+        {
+            if (reqs[i].res == (int)reqs[i].size)
+            {
+                continue;
+            }
+            newfs_volume.retry_cnt++;
+            if (newfs_vol_fail(members[i]) != NFS_ERROR_NONE ||
+                parity_read_degraded(vol_off[i], (uint8_t *)reqs[i].buf, reqs[i].size) != NFS_ERROR_NONE)
+            {
+                ret = -NFS_ERROR_IO;
+            }
+        }
+    }
+    pthread_mutex_unlock(&newfs_volume.lock);
+    return ret;
+}
+
+/**
+ * @brief 事件计数加一后写入所有正常成员的卷标，此后故障成员的卷标落后，
+ * 即使再次出现也不会被当作最新副本
+ */
+static void label_write()
+{
+    static pthread_mutex_t label_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct newfs_vol_label *label;
+    uint8_t *unit = (uint8_t *)calloc(1, newfs_volume.sz_io);
+    int i;
+
+    if (unit == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&label_lock);
+    label = (struct newfs_vol_label *)unit;
+    label->magic = NFS_VOL_LABEL_MAGIC;
+    label->level = newfs_volume.level;
+    label->events = ++newfs_volume.events;
+    /* 写失败的成员会在下一次读写时被摘除，这里不再递归 */
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        if (!newfs_volume.members[i].failed)
+        {
+            ddriver_pwrite(NFS_MEMBER_FD(i), (char *)unit, newfs_volume.sz_io, newfs_volume.member_sz);
+        }
+    }
+    pthread_mutex_unlock(&label_lock);
+    free(unit);
+}
+
+/**
+ * @brief 挂载时比对各成员的卷标：卷标缺失或事件计数落后于最新者，
+ * 说明是新换上的空白镜像或错过了写入的旧成员，按故障成员处理
+ *
+ * @return int
+ */
+static int label_check()
+{
+    struct newfs_vol_label *labels = (struct newfs_vol_label *)calloc(newfs_volume.nr_members, newfs_volume.sz_io);
+    struct newfs_vol_label *label;
+    boolean valid[NFS_VOL_MAX_MEMBERS];
+    int64_t events = -1;
+    int i;
+
+    if (labels == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        label = (struct newfs_vol_label *)((uint8_t *)labels + i * newfs_volume.sz_io);
+        valid[i] = FALSE;
+        if (newfs_volume.members[i].failed ||
+            ddriver_pread(NFS_MEMBER_FD(i), (char *)label, newfs_volume.sz_io, newfs_volume.member_sz) < 0)
+        {
+            newfs_volume.members[i].failed = TRUE;
+            continue;
+        }
+        valid[i] = label->magic == NFS_VOL_LABEL_MAGIC && label->level == newfs_volume.level;
+        if (valid[i] && label->events > events)
+        {
+            events = label->events;
+        }
+    }
+
+    /* 全新的卷没有任何卷标 */
+    for (i = 0; i < newfs_volume.nr_members && events >= 0; i++)
+    {
+        label = (struct newfs_vol_label *)((uint8_t *)labels + i * newfs_volume.sz_io);
+        if (!newfs_volume.members[i].failed && (!valid[i] || label->events < events))
+        {
+            NFS_DBG("[%s] %s is stale, needs resync\n", __func__, newfs_volume.members[i].path);
+            newfs_volume.members[i].failed = TRUE;
+        }
+    }
+    free(labels);
+    if (!members_intact())
+    {
+        return -NFS_ERROR_IO;
+    }
+    newfs_volume.events = events < 0 ? 0 : events;
+    label_write();
+    return NFS_ERROR_NONE;
+}
+
+/******************************************************************************
+ * SECTION: 卷接口
+ *******************************************************************************/
+/**
+ * @brief 打开卷：device为逗号分隔的镜像列表，条带卷按条带单元轮流排布，
+ * 镜像卷每个成员存一份副本，校验卷每行含nr_parity个轮转的校验单元；
+ * 单个镜像时卷即该设备本身
+ *
+ * @param options
+ * @return int
+ */
+int newfs_vol_open(struct custom_options options)
+{
+    char *devices = strdup(options.device);
+    char *saveptr = NULL;
+    char *path;
+    int64_t member_sz = -1;
+    int sz_io = 0;
+    int n = 0;
+    int ret = NFS_ERROR_NONE;
+
+    newfs_volume.level = options.raid;
+    newfs_volume.nr_parity = options.raid == NFS_RAID_P ? 1 : (options.raid == NFS_RAID_PQ ? 2 : 0);
+    newfs_volume.stripe_sz = (options.stripe_kb > 0 ? options.stripe_kb : NFS_STRIPE_DEFAULT_KB) * 1024;
+    newfs_volume.sz_io = 0;
+    newfs_volume.rr = 0;
+    newfs_volume.split_cnt = 0;
+    newfs_volume.chunk_cnt = 0;
+    newfs_volume.retry_cnt = 0;
+    newfs_volume.full_cnt = 0;
+    newfs_volume.rmw_cnt = 0;
+    newfs_volume.recon_cnt = 0;
+    newfs_volume.row_buf = NULL;
+    if (options.raid != NFS_RAID_STRIPE && options.raid != NFS_RAID_MIRROR &&
+        options.raid != NFS_RAID_P && options.raid != NFS_RAID_PQ)
+    {
+        NFS_DBG("[%s] unsupported raid level %d\n", __func__, options.raid);
+        free(devices);
+        return -NFS_ERROR_INVAL;
+    }
+    for (path = strtok_r(devices, ",", &saveptr); path != NULL; path = strtok_r(NULL, ",", &saveptr))
+    {
+        if (n == NFS_VOL_MAX_MEMBERS)
+        {
+            NFS_DBG("[%s] at most %d members\n", __func__, NFS_VOL_MAX_MEMBERS);
+            ret = -NFS_ERROR_INVAL;
+            break;
+        }
+        ret = member_open(&newfs_volume.members[n], path, options.mmap);
+        n++;
+        if (ret != NFS_ERROR_NONE && options.raid != NFS_RAID_STRIPE)
+        {
+            /* 冗余卷缺成员仍可挂载，缺得太多由label_check拒绝 */
+            newfs_volume.members[n - 1].failed = TRUE;
+            ret = NFS_ERROR_NONE;
+            continue;
+        }
+        if (ret != NFS_ERROR_NONE)
+        {
+            break;
+        }
+        ddriver_ioctl(NFS_MEMBER_FD(n - 1), IOC_REQ_DEVICE_IO_SZ, &sz_io);
+        if (newfs_volume.sz_io != 0 && sz_io != newfs_volume.sz_io)
+        {
+            NFS_DBG("[%s] %s io size %d differs from %d\n", __func__, path, sz_io, newfs_volume.sz_io);
+            ret = -NFS_ERROR_INVAL;
+            break;
+        }
+        newfs_volume.sz_io = sz_io;
+        if (member_sz < 0 || newfs_volume.members[n - 1].size < member_sz)
+        {
+            member_sz = newfs_volume.members[n - 1].size;
+        }
+    }
+    free(devices);
+    newfs_volume.nr_members = n;
+
+    if (ret == NFS_ERROR_NONE && newfs_volume.sz_io == 0)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    if (ret == NFS_ERROR_NONE && newfs_volume.nr_parity > 0 && n < newfs_volume.nr_parity + 2)
+    {
+        NFS_DBG("[%s] raid %d needs at least %d members\n", __func__, options.raid, newfs_volume.nr_parity + 2);
+        ret = -NFS_ERROR_INVAL;
+    }
+    if (ret == NFS_ERROR_NONE && n > 1 && newfs_volume.stripe_sz % newfs_volume.sz_io != 0)
+    {
+        NFS_DBG("[%s] stripe %d not a multiple of io size %d\n", __func__,
+                newfs_volume.stripe_sz, newfs_volume.sz_io);
+        ret = -NFS_ERROR_INVAL;
+    }
+    if (ret != NFS_ERROR_NONE)
+    {
+        members_close(n);
+        newfs_volume.nr_members = 0;
+        return ret;
+    }
+
+    if (options.raid != NFS_RAID_STRIPE)
+    {
+        /* 末尾一个IO单元留作卷标 */
+        if (options.raid == NFS_RAID_MIRROR)
+        {
+            newfs_volume.member_sz = member_sz - newfs_volume.sz_io;
+            newfs_volume.size = newfs_volume.member_sz;
+        }
+        else
+        {
+            newfs_volume.member_sz = NFS_ROUND_DOWN(member_sz - newfs_volume.sz_io, newfs_volume.stripe_sz);
+            newfs_volume.size = newfs_volume.member_sz * (n - newfs_volume.nr_parity);
+            /* 一行暂存之后是整行批量写时各行的校验单元 */
+            newfs_volume.row_buf = (uint8_t *)malloc(
+                (size_t)(n + NFS_VOL_BATCH / n * newfs_volume.nr_parity) * newfs_volume.stripe_sz);
+            if (newfs_volume.row_buf == NULL)
+            {
+                members_close(n);
+                newfs_volume.nr_members = 0;
+                return -NFS_ERROR_NOSPACE;
+            }
+        }
+        ret = label_check();
+        if (ret != NFS_ERROR_NONE)
+        {
+            newfs_vol_close();
+            return ret;
+        }
+    }
+    else if (n == 1)
+    {
+        newfs_volume.member_sz = member_sz;
+        newfs_volume.size = member_sz;
+    }
+    else
+    {
+        /* 条带卷只用到最小成员的整数个条带单元 */
+        newfs_volume.member_sz = NFS_ROUND_DOWN(member_sz, newfs_volume.stripe_sz);
+        newfs_volume.size = newfs_volume.member_sz * n;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 卷内一段写在各成员上的落点：条带卷为一个成员，镜像卷为所有正常成员，
+ * 各落点的成员内偏移相同；校验卷的写须同时更新校验，没有直接落点
+ *
+ * @param offset 卷内偏移
+ * @param size 期望长度
+ * @param members 返回目标成员，至少NFS_VOL_MAX_MEMBERS个
+ * @param member_off 返回成员内偏移
+ * @param len 返回不超过size、且不跨越条带单元的长度
+ * @return int 目标成员数，为0时调用者须改用newfs_vol_pwrite
+ */
+int newfs_vol_map_write(int64_t offset, int size, int *members, int64_t *member_off, int *len)
+{
+    int nr = 0;
+    int i;
+
+    if (newfs_volume.nr_parity > 0)
+    {
+        return 0;
+    }
+    if (newfs_volume.level == NFS_RAID_STRIPE)
+    {
+        members[0] = stripe_map(offset, size, member_off, len);
+        return 1;
+    }
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        if (!newfs_volume.members[i].failed)
+        {
+            members[nr++] = i;
+        }
+    }
+    *member_off = offset;
+    *len = size;
+    return nr;
+}
+
+/**
+ * @brief 标记成员故障，之后不再访问
+ *
+ * @param member
+ * @return int 卷仍有完整数据返回NFS_ERROR_NONE
+ */
+int newfs_vol_fail(int member)
+{
+    struct newfs_member *target = &newfs_volume.members[member];
+
+    if (!__atomic_exchange_n(&target->failed, TRUE, __ATOMIC_RELAXED))
+    {
+        NFS_DBG("[%s] member %d (%s) failed, %d left\n", __func__, member,
+                target->path, members_healthy());
+        if (newfs_volume.level != NFS_RAID_STRIPE)
+        {
+            label_write();
+        }
+    }
+    return newfs_volume.level != NFS_RAID_STRIPE && members_intact() ? NFS_ERROR_NONE : -NFS_ERROR_IO;
+}
+
+/**
+ * @brief 读卷
+ *
+ * @param offset 按IO单元对齐
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+int newfs_vol_pread(int64_t offset, uint8_t *buf, int size)
+{
+    if (newfs_volume.level == NFS_RAID_MIRROR)
+    {
+        return mirror_read(offset, buf, size);
+    }
+    if (newfs_volume.nr_parity > 0)
+    {
+        return parity_read(offset, buf, size);
+    }
+    return stripe_rw(DDRIVER_OP_READ, offset, buf, size);
+}
+
+/**
+ * @brief 写卷
+ *
+ * @param offset 按IO单元对齐
+ * @param buf
+ * @param size IO单元的整数倍
+ * @return int
+ */
+int newfs_vol_pwrite(int64_t offset, uint8_t *buf, int size)
+{
+    if (newfs_volume.level == NFS_RAID_MIRROR)
+    {
+        return mirror_write(offset, buf, size);
+    }
+    if (newfs_volume.nr_parity > 0)
+    {
+        return parity_write(offset, buf, size);
+    }
+    return stripe_rw(DDRIVER_OP_WRITE, offset, buf, size);
+}
+
+/**
+ * @brief 获取卷内一段区间在设备映射中的地址，区间跨越条带单元、
+ * 写入有多份副本的镜像、写入校验卷或读取缺失的单元时返回NULL，调用者须退回普通读写
+ *
+ * @param offset 按IO单元对齐
+ * @param size IO单元的整数倍
+ * @param flags DDRIVER_MAP_READ / DDRIVER_MAP_WRITE
+ * @return char*
+ */
+char *newfs_vol_map_block(int64_t offset, int size, int flags)
+{
+    int64_t member_off;
+    int member;
+    int len;
+
+    if (newfs_volume.level == NFS_RAID_MIRROR)
+    {
+        if ((flags & DDRIVER_MAP_WRITE) && members_healthy() > 1)
+        {
+            return NULL;
+        }
+        member = mirror_pick(offset);
+        return member < 0 ? NULL : ddriver_map_block(NFS_MEMBER_FD(member), offset, size, flags);
+    }
+    if (newfs_volume.nr_parity > 0)
+    {
+        member = parity_map(offset, size, &member_off, &len);
+        if ((flags & DDRIVER_MAP_WRITE) || newfs_volume.members[member].failed)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        member = stripe_map(offset, size, &member_off, &len);
+    }
+    if (len != size)
+    {
+        return NULL;
+    }
+    return ddriver_map_block(NFS_MEMBER_FD(member), member_off, size, flags);
+}
+
+/**
+ * @brief 丢弃卷内一段区间，条带卷中各成员上连续的部分合并为一次丢弃，
+ * 镜像卷在每个正常成员上丢弃同一区间；校验卷只丢弃完整的行，
+ * 整行归零后校验仍然成立，不足一行的部分保留
+ *
+ * @param offset 按IO单元对齐
+ * @param len IO单元的整数倍
+ * @return int
+ */
+int newfs_vol_discard(int64_t offset, int64_t len)
+{
+    struct ddriver_discard pending[NFS_VOL_MAX_MEMBERS];
+    int64_t member_off, row_sz, first, last;
+    int member, chunk, i;
+    int ret = NFS_ERROR_NONE;
+
+    memset(pending, 0, sizeof(pending));
+    if (newfs_volume.nr_parity > 0)
+    {
+        row_sz = (int64_t)(newfs_volume.nr_members - newfs_volume.nr_parity) * newfs_volume.stripe_sz;
+        first = NFS_ROUND_UP(offset, row_sz) / row_sz;
+        last = (offset + len) / row_sz;
+        for (i = 0; i < newfs_volume.nr_members; i++)
+        {
+            pending[i].offset = first * newfs_volume.stripe_sz;
+            pending[i].len = newfs_volume.members[i].failed || last <= first
+                                 ? 0 : (last - first) * newfs_volume.stripe_sz;
+        }
+        len = 0;
+    }
+    else if (newfs_volume.level == NFS_RAID_MIRROR)
+    {
+        for (i = 0; i < newfs_volume.nr_members; i++)
+        {
+            pending[i].offset = offset;
+            pending[i].len = newfs_volume.members[i].failed ? 0 : len;
+        }
+        len = 0;
+    }
+    while (len > 0)
+    {
+        member = stripe_map(offset, len > INT_MAX ? INT_MAX : (int)len, &member_off, &chunk);
+        if (pending[member].len > 0 && pending[member].offset + pending[member].len != member_off)
+        {
+            if (ddriver_ioctl(NFS_MEMBER_FD(member), IOC_REQ_DEVICE_DISCARD, &pending[member]) < 0)
+            {
+                ret = -NFS_ERROR_IO;
+            }
+            pending[member].len = 0;
+        }
+        if (pending[member].len == 0)
+        {
+            pending[member].offset = member_off;
+        }
+        pending[member].len += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        if (pending[i].len > 0 && ddriver_ioctl(NFS_MEMBER_FD(i), IOC_REQ_DEVICE_DISCARD, &pending[i]) < 0)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief 持久化所有正常成员
+ *
+ * @return int
+ */
+int newfs_vol_sync()
+{
+    int i;
+    int ret = NFS_ERROR_NONE;
+
+    for (i = 0; i < newfs_volume.nr_members; i++)
+    {
+        if (!newfs_volume.members[i].failed && ddriver_sync(NFS_MEMBER_FD(i)) < 0 &&
+            newfs_vol_fail(i) != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief 关闭卷的所有成员
+ */
+void newfs_vol_close()
+{
+    members_close(newfs_volume.nr_members);
+    newfs_volume.nr_members = 0;
+    free(newfs_volume.row_buf);
+    newfs_volume.row_buf = NULL;
+}
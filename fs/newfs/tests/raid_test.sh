@@ -0,0 +1,196 @@
+#!/bin/bash
+# 多成员卷测试：在~/ddriver的兄弟镜像上按条带、镜像、RAID 5、RAID 6挂载，
+# 写入文件后卸载，逐个删掉成员镜像(重新打开时是空白设备)再挂载，校验文件内容
+
+WORK_DIR=$(cd "$(dirname "$0")"; pwd)
+cd "$WORK_DIR" || exit
+
+MNTPOINT="$WORK_DIR"/mnt
+PROJECT_NAME="newfs"
+GOLDEN_DIR=$(mktemp -d)
+NR_FILES=8
+POINTS=0
+ALL_POINTS=0
+
+function pass() {
+    RES=$1
+    POINTS=$((POINTS + 1))
+    ALL_POINTS=$((ALL_POINTS + 1))
+    echo -e "\033[32mpass: ${RES}\033[0m"
+}
+
+function fail() {
+    RES=$1
+    ALL_POINTS=$((ALL_POINTS + 1))
+    echo -e "\033[31mfail: ${RES}\033[0m"
+}
+
+function check_mount() {
+    mount | grep "${MNTPOINT}" >/dev/null
+}
+
+function clean_mount() {
+    while check_mount; do
+        umount "${MNTPOINT}"
+        sleep 1
+    done
+}
+
+# 成员镜像为~/ddriverraid0、~/ddriverraid1...，连同各自的几何旁路文件
+function member_path() {
+    echo "$HOME"/ddriverraid"$1"
+}
+
+function kill_member() {
+    rm -f "$(member_path "$1")" "$(member_path "$1")"_geo
+}
+
+function clean_members() {
+    for ((i = 0; i < 8; i++)); do
+        kill_member "$i"
+    done
+}
+
+function device_list() {
+    NR=$1
+    LIST=$(member_path 0)
+    for ((i = 1; i < NR; i++)); do
+        LIST="$LIST,$(member_path "$i")"
+    done
+    echo "$LIST"
+}
+
+# mount_volume RAID NR_MEMBERS
+function mount_volume() {
+    ../build/"${PROJECT_NAME}" --device="$(device_list "$2")" --raid="$1" "${MNTPOINT}" >/dev/null 2>&1 && check_mount
+}
+
+function write_files() {
+    mkdir -p "${MNTPOINT}"/dir0
+    for ((i = 0; i < NR_FILES; i++)); do
+        head -c $((RANDOM % 12288 + 1)) /dev/urandom > "$GOLDEN_DIR"/file"$i"
+        cp "$GOLDEN_DIR"/file"$i" "${MNTPOINT}"/dir0/file"$i" || return 1
+    done
+}
+
+function verify_files() {
+    for ((i = 0; i < NR_FILES; i++)); do
+        if ! cmp -s "$GOLDEN_DIR"/file"$i" "${MNTPOINT}"/dir0/file"$i"; then
+            echo "dir0/file$i 内容不一致"
+            return 1
+        fi
+    done
+    return 0
+}
+
+# remount_and_verify CASE RAID NR_MEMBERS
+function remount_and_verify() {
+    clean_mount
+    if ! mount_volume "$2" "$3"; then
+        fail "$1: 挂载失败"
+        return 1
+    fi
+    if ! verify_files; then
+        fail "$1: 文件内容错误"
+        clean_mount
+        return 1
+    fi
+    pass "$1"
+    clean_mount
+    return 0
+}
+
+# expect_refused CASE RAID NR_MEMBERS：缺失成员超过冗余度时必须拒绝挂载
+function expect_refused() {
+    clean_mount
+    if mount_volume "$2" "$3"; then
+        fail "$1: 冗余不足仍挂载成功"
+        clean_mount
+        return 1
+    fi
+    pass "$1"
+    return 0
+}
+
+# prepare_volume CASE RAID NR_MEMBERS：全新格式化并写入文件
+function prepare_volume() {
+    clean_mount
+    clean_members
+    if ! mount_volume "$2" "$3"; then
+        fail "$1: 挂载失败"
+        return 1
+    fi
+    if ! write_files; then
+        fail "$1: 写入文件失败"
+        clean_mount
+        return 1
+    fi
+    pass "$1"
+    return 0
+}
+
+function test_stripe() {
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_STRIPE"
+    prepare_volume "stripe - write" 0 3 &&
+        remount_and_verify "stripe - remount" 0 3
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+function test_mirror() {
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_MIRROR"
+    prepare_volume "mirror - write" 1 3 &&
+        remount_and_verify "mirror - remount" 1 3 &&
+        kill_member 0 &&
+        remount_and_verify "mirror - lose member 0" 1 3 &&
+        kill_member 2 &&
+        remount_and_verify "mirror - lose members 0, 2" 1 3
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+function test_raid5() {
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_RAID5"
+    prepare_volume "raid5 - write" 5 4 &&
+        remount_and_verify "raid5 - remount" 5 4 &&
+        kill_member 1 &&
+        remount_and_verify "raid5 - lose member 1" 5 4 &&
+        kill_member 3 &&
+        expect_refused "raid5 - lose members 1, 3" 5 4
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+function test_raid6() {
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_RAID6"
+    prepare_volume "raid6 - write" 6 5 &&
+        remount_and_verify "raid6 - remount" 6 5 &&
+        kill_member 0 &&
+        remount_and_verify "raid6 - lose member 0" 6 5 &&
+        kill_member 3 &&
+        remount_and_verify "raid6 - lose members 0, 3" 6 5 &&
+        kill_member 4 &&
+        expect_refused "raid6 - lose members 0, 3, 4" 6 5
+    echo "<<<<<<<<<<<<<<<<<<<<"
+}
+
+if [ ! -x ../build/"${PROJECT_NAME}" ]; then
+    cd ..; mkdir build >/dev/null 2>&1; cd build || exit
+    if ! (cmake .. >/dev/null 2>&1 && make >/dev/null 2>&1); then
+        echo "Test Fail : 编译失败"
+        exit 1
+    fi
+    cd ../tests || exit
+fi
+mkdir -p "${MNTPOINT}"
+
+test_stripe
+test_mirror
+test_raid5
+test_raid6
+
+clean_mount
+clean_members
+rm -rf "$GOLDEN_DIR"
+
+echo "Score: $POINTS/$ALL_POINTS"
+if [ $POINTS -ne $ALL_POINTS ]; then
+    exit 1
+fi